@@ -0,0 +1,682 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Benchmarks of the hot paths of the nxslib plugin. Each measurement is printed
+//as a single line of JSON on stdout, with a stable set of keys, so results of
+//different builds can be compared by scripts. Run with the names of the suites
+//to run as arguments (default is all):
+//
+//   load  : full loadNXSCrystal + hkl list production for each file in data/
+//           at several dcutoff values.
+//   hkl   : isolated nxs_initHKLList and nxs_calcFSquare throughput, and
+//           direct versus FFT structure factors of the synthetic crystals.
+//   xsect : xsectScatNonBragg calls per second for each background model,
+//           and the background kernel versus background table lookups.
+//   edges : coherent elastic cross sections on a 10^5 point wavelength grid,
+//           point by point versus coherentElasticSpectrum (serial and
+//           parallel, on the nxslib list and on NXSCompactHKL).
+//   scaling : load time and memory of synthetic low-symmetry crystals versus
+//             number of sites and dcutoff (files are written to a temporary
+//             directory).
+//   threads : NC::createInfo+createScatter of all files in data/ from N
+//             threads at once (after clearing caches), reporting throughput
+//             versus N and checking that results are bit-identical to those of
+//             serial loading. Exits with an error in case of differences.
+//
+//The synthetic files used by the scaling suite can also be written to a given
+//directory with "nxslib_bench gen <outdir>".
+//
+//The environment variable NCPLUGIN_BENCH_MINTIME can be used to change the
+//minimum time (in seconds, default 0.2) spent on each measurement.
+
+#include "NCFactory_NXS.hh"
+#include "NCNXSBkgdTable.hh"
+#include "NCNXSBraggEdges.hh"
+#include "NCNXSFSquare.hh"
+#include "NCNXSLib.hh"
+#include "NCNXSLoadStats.hh"
+#include "NCrystal/NCrystal.hh"
+#include "NCrystal/factories/NCFactImpl.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#ifdef __linux__
+#  include <unistd.h>
+#endif
+
+namespace NC = NCrystal;
+namespace nxs = NCP::nxs;
+
+namespace {
+
+  double minTime()
+  {
+    const char * s = std::getenv("NCPLUGIN_BENCH_MINTIME");
+    double v = ( s ? std::atof(s) : 0.0 );
+    return v > 0.0 ? v : 0.2;
+  }
+
+  struct Measurement {
+    std::uint64_t reps = 0;
+    double time = 0.0;//total
+  };
+
+  //Call fct repeatedly until at least minTime() has passed:
+  template<class TFct>
+  Measurement measure( TFct&& fct )
+  {
+    const double tmin = minTime();
+    Measurement m;
+    NCP::StageTimer timer;
+    do {
+      fct();
+      ++m.reps;
+      m.time += timer.lap();
+    } while ( m.time < tmin );
+    return m;
+  }
+
+  class JSONLine {
+  public:
+    JSONLine( const char * suite ) { m_os.precision(9); add("suite",suite); }
+    JSONLine& add( const char * key, const std::string& val )
+    {
+      sep();
+      m_os << '"' << key << "\":\"";
+      for ( char c : val ) {
+        if ( c == '"' || c == '\\' )
+          m_os << '\\';
+        m_os << c;
+      }
+      m_os << '"';
+      return *this;
+    }
+    JSONLine& add( const char * key, const char * val ) { return add(key,std::string(val)); }
+    template<class TNumber>
+    JSONLine& add( const char * key, TNumber val )
+    {
+      sep();
+      m_os << '"' << key << "\":" << val;
+      return *this;
+    }
+    JSONLine& add( const Measurement& m, std::uint64_t ops_per_rep = 1 )
+    {
+      add("reps",m.reps);
+      add("time_per_rep",m.time/m.reps);
+      add("ops_per_s",double(ops_per_rep)*m.reps/m.time);
+      return *this;
+    }
+    ~JSONLine() { std::cout << '{' << m_os.str() << '}' << std::endl; }
+  private:
+    void sep() { if (!m_first) m_os << ','; m_first = false; }
+    std::ostringstream m_os;
+    bool m_first = true;
+  };
+
+  std::vector<std::string> dataFiles()
+  {
+    std::vector<std::string> res;
+    for ( auto& e : std::filesystem::directory_iterator( NCPLUGIN_BENCH_DATADIR ) )
+      if ( e.is_regular_file() && e.path().extension() == ".nxs" )
+        res.push_back( e.path().string() );
+    std::sort( res.begin(), res.end() );
+    return res;
+  }
+
+  std::string baseName( const std::string& fn )
+  {
+    return std::filesystem::path(fn).filename().string();
+  }
+
+  NC::TextDataSP loadTextData( const std::string& fn )
+  {
+    return NC::FactImpl::createTextData( NC::TextDataPath( fn ) );
+  }
+
+  NC::InfoPtr loadInfo( const NC::TextData& td,
+                        double dcutoff,
+                        NC::Optional<NCP::NXSBkgdModel> bkgdmodel = NC::NullOpt )
+  {
+    auto builder = NCP::loadNXSCrystal( td, NC::Temperature{293.15},
+                                        dcutoff, NC::kInfinity,
+                                        bkgdmodel );
+    builder.dataSourceName = td.dataSourceName();
+    return NC::InfoBuilder::buildInfoPtr( std::move(builder) );
+  }
+
+  //Direct usage of the nxslib C-API (bypassing the plugin factory):
+
+  struct NXSCell {
+    nxs::NXS_UnitCell uc;
+    NXSCell( const std::string& fn, unsigned maxhkl )
+    {
+      std::memset(&uc,0,sizeof(uc));
+      s_file = std::fopen( fn.c_str(), "r" );
+      if (!s_file)
+        NCRYSTAL_THROW2(FileNotFound,"Could not open "<<fn);
+      nxs::NXS_AtomInfo * atomInfoList = nullptr;
+      int n = nxs::nxs_readParameterFile( fgets_file, &uc, &atomInfoList );
+      std::fclose(s_file);
+      s_file = nullptr;
+      if ( n <= 0 || NXS_ERROR_OK != nxs::nxs_initUnitCell(&uc) )
+        NCRYSTAL_THROW2(DataLoadError,"Could not load "<<fn);
+      uc.temperature = 293.15;
+      for ( int i = 0; i < n; ++i )
+        nxs::nxs_addAtomInfo( &uc, atomInfoList[i] );
+      std::free(atomInfoList);
+      nxs::nxs_initAverageSigma( &uc, 0 );
+      uc.maxHKL_index = maxhkl;
+    }
+    ~NXSCell()
+    {
+      freeHKL();
+      std::free(uc.sgInfo.ListSeitzMx);
+      std::free(uc.atomInfoList);
+    }
+    void initHKL()
+    {
+      freeHKL();
+      if ( NXS_ERROR_OK != nxs::nxs_initHKLList(&uc) )
+        NCRYSTAL_THROW(CalcError,"nxs_initHKLList failed");
+    }
+    void freeHKL()
+    {
+      for ( unsigned i = 0; i < uc.nHKL; ++i )
+        std::free( uc.hklList[i].equivHKL );
+      std::free( uc.hklList );
+      uc.hklList = nullptr;
+      std::free( uc.hklCumFMd );
+      uc.hklCumFMd = nullptr;
+      uc.nHKL = 0;
+    }
+  private:
+    static FILE * s_file;
+    static char * fgets_file( char * str, int count ) { return std::fgets( str, count, s_file ); }
+  };
+  FILE * NXSCell::s_file = nullptr;
+
+  //Synthetic crystals with many sites in low-symmetry space groups and large
+  //unit cells, for testing how things scale:
+
+  struct SyntheticSpec {
+    unsigned spacegroup;//1, 2 (triclinic), 14 or 15 (monoclinic)
+    unsigned nsites;
+  };
+
+  unsigned spaceGroupOrder( unsigned sg )
+  {
+    switch ( sg ) {
+    case 1: return 1;
+    case 2: return 2;
+    case 14: return 4;
+    case 15: return 8;
+    default:
+      NCRYSTAL_THROW2(BadInput,"Unsupported space group for synthetic crystals: "<<sg);
+    }
+  }
+
+  std::string syntheticName( const SyntheticSpec& spec )
+  {
+    std::ostringstream ss;
+    ss << "synth_sg" << spec.spacegroup << "_n" << spec.nsites << ".nxs";
+    return ss.str();
+  }
+
+  std::string generateSyntheticNXS( const SyntheticSpec& spec )
+  {
+    //Elements must always be specified with identical constants:
+    struct Element { const char * name; double bcoh, sigma_inc, sigma_abs, molar_mass; };
+    static const Element elements[] = { { "O", 5.803, 0.0008, 0.00019, 15.999 },
+                                        { "Si", 4.1491, 0.004, 0.171, 28.085 },
+                                        { "Al", 3.449, 0.0082, 0.231, 26.982 },
+                                        { "Fe", 9.45, 0.4, 2.56, 55.845 },
+                                        { "Ca", 4.70, 0.05, 0.43, 40.078 },
+                                        { "Na", 3.63, 1.62, 0.53, 22.990 } };
+    const unsigned nelements = sizeof(elements)/sizeof(elements[0]);
+
+    //Volume of roughly 12Aa^3 per atom:
+    const unsigned natoms = spec.nsites * spaceGroupOrder( spec.spacegroup );
+    const bool triclinic = spec.spacegroup <= 2;
+    const double alpha = ( triclinic ? 81.0 : 90.0 );
+    const double beta = 103.5;
+    const double gamma = ( triclinic ? 95.0 : 90.0 );
+    const double a = std::cbrt( 12.0 * natoms / ( 1.13 * 1.27 ) );
+
+    std::ostringstream ss;
+    ss.precision(10);
+    ss << "# Synthetic crystal generated by nxslib_bench\n"
+       << "space_group = " << spec.spacegroup << "\n"
+       << "lattice_a = " << a << "\n"
+       << "lattice_b = " << 1.13 * a << "\n"
+       << "lattice_c = " << 1.27 * a << "\n"
+       << "lattice_alpha = " << alpha << "\n"
+       << "lattice_beta = " << beta << "\n"
+       << "lattice_gamma = " << gamma << "\n"
+       << "debye_temp = 350\n"
+       << "[atoms]\n";
+    //Positions from a simple LCG, so the files are reproducible:
+    std::uint64_t state = 0x9e3779b97f4a7c15ull + spec.spacegroup * 1000003ull + spec.nsites;
+    auto rand01 = [&state]()
+    {
+      state = state * 6364136223846793005ull + 1442695040888963407ull;
+      return ( state >> 11 ) * ( 1.0 / 9007199254740992.0 );
+    };
+    for ( unsigned i = 0; i < spec.nsites; ++i ) {
+      const Element& e = elements[i%nelements];
+      const double x = rand01(), y = rand01(), z = rand01();
+      ss << "add_atom = " << e.name << ' ' << e.bcoh << ' ' << e.sigma_inc << ' '
+         << e.sigma_abs << ' ' << e.molar_mass << ' ' << x << ' ' << y << ' ' << z << "\n";
+    }
+    return ss.str();
+  }
+
+  std::vector<SyntheticSpec> syntheticSpecs()
+  {
+    std::vector<SyntheticSpec> res;
+    for ( unsigned sg : { 1u, 2u, 14u, 15u } )
+      for ( unsigned nsites : { 1u, 4u, 16u, 64u } )
+        res.push_back( { sg, nsites } );
+    return res;
+  }
+
+  std::vector<std::string> writeSyntheticFiles( const std::filesystem::path& outdir )
+  {
+    std::filesystem::create_directories( outdir );
+    std::vector<std::string> res;
+    for ( auto& spec : syntheticSpecs() ) {
+      auto fn = ( outdir / syntheticName( spec ) ).string();
+      std::ofstream ofs( fn );
+      ofs << generateSyntheticNXS( spec );
+      if ( !ofs )
+        NCRYSTAL_THROW2(FileNotFound,"Could not write "<<fn);
+      res.push_back( fn );
+    }
+    return res;
+  }
+
+  std::uint64_t residentBytes()
+  {
+    //Current resident set size (only implemented on Linux, 0 elsewhere):
+#ifdef __linux__
+    std::ifstream ifs( "/proc/self/statm" );
+    std::uint64_t size(0), resident(0);
+    if ( ifs >> size >> resident )
+      return resident * static_cast<std::uint64_t>( sysconf( _SC_PAGESIZE ) );
+#endif
+    return 0;
+  }
+
+  void benchLoad()
+  {
+    for ( auto& fn : dataFiles() ) {
+      auto td = loadTextData( fn );
+      for ( double dcutoff : { -1.0, 0.0, 0.5, 0.25 } ) {
+        std::size_t nhkl = 0;
+        auto m = measure( [&td,dcutoff,&nhkl]()
+        {
+          auto info = loadInfo( *td, dcutoff );
+          nhkl = ( info->hasHKLInfo() ? info->hklList().size() : 0 );
+        } );
+        JSONLine("load").add("file",baseName(fn)).add("dcutoff",dcutoff)
+          .add("nhkl",nhkl).add(m);
+      }
+    }
+  }
+
+  void benchHKL()
+  {
+    for ( auto& fn : dataFiles() ) {
+      for ( unsigned maxhkl : { 6u, 10u } ) {
+        NXSCell cell( fn, maxhkl );
+        auto m = measure( [&cell](){ cell.initHKL(); } );
+        JSONLine("hkl").add("case","initHKLList").add("file",baseName(fn))
+          .add("maxhkl",maxhkl).add("nhkl",cell.uc.nHKL).add(m);
+        double sum = 0.0;
+        auto m2 = measure( [&cell,&sum]()
+        {
+          for ( unsigned i = 0; i < cell.uc.nHKL; ++i )
+            sum += nxs::nxs_calcFSquare( &cell.uc.hklList[i], &cell.uc );
+        } );
+        JSONLine("hkl").add("case","calcFSquare").add("file",baseName(fn))
+          .add("maxhkl",maxhkl).add("nhkl",cell.uc.nHKL).add(m2,cell.uc.nHKL)
+          .add("checksum",sum/m2.reps);
+      }
+    }
+    for ( auto& fn : writeSyntheticFiles( std::filesystem::temp_directory_path() / "nxslib_bench_synth" ) ) {
+      NXSCell cell( fn, 10 );
+      cell.initHKL();
+      const unsigned n = cell.uc.nHKL;
+      std::vector<nxs::NXS_HKL> hkl_direct( cell.uc.hklList, cell.uc.hklList + n );
+      std::vector<nxs::NXS_HKL> hkl_fft( hkl_direct );
+      auto md = measure( [&cell,&hkl_direct,n](){ NCP::calcFSquareDirect( cell.uc, hkl_direct.data(), n ); } );
+      auto mf = measure( [&cell,&hkl_fft,n](){ NCP::calcFSquareFFT( cell.uc, hkl_fft.data(), n ); } );
+      double fsqmax = 0.0, maxdev = 0.0;
+      for ( unsigned i = 0; i < n; ++i ) {
+        fsqmax = std::max( fsqmax, hkl_direct[i].FSquare );
+        maxdev = std::max( maxdev, std::fabs( hkl_fft[i].FSquare - hkl_direct[i].FSquare ) );
+      }
+      JSONLine("hkl").add("case","fsquare_direct").add("file",baseName(fn))
+        .add("natoms",cell.uc.nAtoms).add("nhkl",n).add(md,n);
+      JSONLine("hkl").add("case","fsquare_fft").add("file",baseName(fn))
+        .add("natoms",cell.uc.nAtoms).add("nhkl",n).add(mf,n)
+        .add("maxdev_rel",fsqmax>0.0?maxdev/fsqmax:0.0)
+        .add("auto_selects_fft",NCP::preferFSquareFFT( cell.uc, hkl_direct.data(), n )?1:0);
+    }
+  }
+
+  void benchScaling()
+  {
+    auto files = writeSyntheticFiles( std::filesystem::temp_directory_path() / "nxslib_bench_synth" );
+    for ( auto& fn : files ) {
+      auto td = loadTextData( fn );
+      for ( double dcutoff : { -1.0, 1.0, 0.7 } ) {
+        //A single load for the memory usage and counters, then the timing:
+        NCP::clearLoadStats();
+        const std::uint64_t rss_before = residentBytes();
+        std::uint64_t natoms(0), nhkl(0), hkl_bytes(0), nsymequiv(0);
+        {
+          auto info = loadInfo( *td, dcutoff );
+          nhkl = ( info->hasHKLInfo() ? info->hklList().size() : 0 );
+          const std::uint64_t rss_after = residentBytes();
+          for ( auto& e : NCP::getLoadStats() ) {
+            if ( e.kind == "info" )
+              natoms = e.nAtoms;
+            if ( e.kind == "hkl" ) {
+              hkl_bytes = e.bytesAllocated;
+              nsymequiv = e.nHKLSymEquivTests;
+            }
+          }
+          JSONLine("scaling").add("case","memory").add("file",baseName(fn))
+            .add("dcutoff",dcutoff).add("natoms",natoms).add("nhkl",nhkl)
+            .add("nsymequivtests",nsymequiv).add("hkl_bytes",hkl_bytes)
+            .add("rss_delta",rss_after>rss_before?rss_after-rss_before:0);
+        }
+        auto m = measure( [&td,dcutoff]()
+        {
+          auto info = loadInfo( *td, dcutoff );
+          if ( info->hasHKLInfo() )
+            (void)info->hklList().size();
+        } );
+        JSONLine("scaling").add("case","load").add("file",baseName(fn))
+          .add("dcutoff",dcutoff).add("natoms",natoms).add("nhkl",nhkl).add(m);
+      }
+    }
+  }
+
+  //Hash of everything we can get out of the Info and Scatter objects, for
+  //comparing results bit by bit:
+  class Fingerprint {
+  public:
+    void add( double v )
+    {
+      std::uint64_t bits;
+      std::memcpy( &bits, &v, sizeof(bits) );
+      add( bits );
+    }
+    void add( std::uint64_t v )
+    {
+      for ( unsigned i = 0; i < 8; ++i ) {
+        m_hash ^= ( v >> (8*i) ) & 0xFF;
+        m_hash *= 0x100000001b3ull;
+      }
+    }
+    std::uint64_t value() const { return m_hash; }
+  private:
+    std::uint64_t m_hash = 0xcbf29ce484222325ull;
+  };
+
+  std::uint64_t fingerprintMaterial( const std::string& cfgstr )
+  {
+    auto info = NC::createInfo( cfgstr );
+    auto scat = NC::createScatter( cfgstr );
+    Fingerprint fp;
+    if ( info->hasHKLInfo() ) {
+      for ( auto& e : info->hklList() ) {
+        fp.add( static_cast<std::uint64_t>( static_cast<std::int64_t>( e.hkl.h ) ) );
+        fp.add( static_cast<std::uint64_t>( static_cast<std::int64_t>( e.hkl.k ) ) );
+        fp.add( static_cast<std::uint64_t>( static_cast<std::int64_t>( e.hkl.l ) ) );
+        fp.add( static_cast<std::uint64_t>( e.multiplicity ) );
+        fp.add( e.dspacing );
+        fp.add( e.fsquared );
+      }
+    }
+    for ( unsigned i = 0; i < 200; ++i ) {
+      const double lambda = 0.1 + 0.05 * i;
+      fp.add( info->xsectScatNonBragg( NC::NeutronWavelength{ lambda } ).dbl() );
+      fp.add( scat->crossSectionIsotropic( NC::NeutronEnergy{ NC::wl2ekin( lambda ) } ).dbl() );
+    }
+    return fp.value();
+  }
+
+  bool benchThreads()
+  {
+    //Make the .nxs factory available to NC::createInfo etc.:
+    NCP::registerPlugin();
+    const auto files = dataFiles();
+    const std::size_t nfiles = files.size();
+
+    //Reference results from serial loading:
+    NC::clearCaches();
+    std::vector<std::uint64_t> reference;
+    for ( auto& fn : files )
+      reference.push_back( fingerprintMaterial( fn ) );
+
+    const unsigned hwthreads = std::max<unsigned>( 1, std::thread::hardware_concurrency() );
+    std::vector<unsigned> nthreads_list;
+    for ( unsigned n = 1; n < 2 * hwthreads; n *= 2 )
+      nthreads_list.push_back( n );
+    if ( nthreads_list.back() != hwthreads )
+      nthreads_list.push_back( hwthreads );
+
+    bool all_identical = true;
+    for ( unsigned nthreads : nthreads_list ) {
+      //Every thread loads every file, each starting at a different file, so
+      //both concurrent loads of different and of identical files happen:
+      NC::clearCaches();
+      std::vector<std::vector<std::uint64_t>> results( nthreads, std::vector<std::uint64_t>( nfiles, 0 ) );
+      std::vector<std::string> errors( nthreads );
+      NCP::StageTimer timer;
+      {
+        std::vector<std::thread> threads;
+        for ( unsigned ithread = 0; ithread < nthreads; ++ithread ) {
+          threads.emplace_back( [ithread,nthreads,nfiles,&files,&results,&errors]()
+          {
+            try {
+              for ( std::size_t j = 0; j < nfiles; ++j ) {
+                const std::size_t ifile = ( j + ( ithread * nfiles ) / nthreads ) % nfiles;
+                results.at(ithread).at(ifile) = fingerprintMaterial( files.at(ifile) );
+              }
+            } catch ( std::exception& e ) {
+              errors.at(ithread) = e.what();
+            }
+          } );
+        }
+        for ( auto& t : threads )
+          t.join();
+      }
+      const double t = timer.lap();
+      unsigned nmismatch = 0;
+      std::string error;
+      for ( unsigned ithread = 0; ithread < nthreads; ++ithread ) {
+        if ( !errors.at(ithread).empty() )
+          error = errors.at(ithread);
+        for ( std::size_t ifile = 0; ifile < nfiles; ++ifile )
+          if ( results.at(ithread).at(ifile) != reference.at(ifile) )
+            ++nmismatch;
+      }
+      if ( nmismatch || !error.empty() )
+        all_identical = false;
+      JSONLine("threads").add("nthreads",nthreads).add("nfiles",nfiles)
+        .add("time",t).add("loads_per_s",double(nthreads*nfiles)/t)
+        .add("nmismatch",nmismatch).add("identical",nmismatch==0&&error.empty()?1:0)
+        .add("error",error);
+    }
+    return all_identical;
+  }
+
+  void benchXSect()
+  {
+    const unsigned nlambda = 1000;
+    for ( auto& fn : dataFiles() ) {
+      auto td = loadTextData( fn );
+      for ( auto bkgdmodel : { NCP::NXSBkgdModel::NXSG4, NCP::NXSBkgdModel::NXSG4_Cassels,
+                               NCP::NXSBkgdModel::NXSG4_Freund, NCP::NXSBkgdModel::McStas } ) {
+        auto info = loadInfo( *td, -1.0, bkgdmodel );
+        double sum = 0.0;
+        auto m = measure( [&info,&sum]()
+        {
+          for ( unsigned i = 0; i < nlambda; ++i ) {
+            const double lambda = 0.1 + 9.9 * i / ( nlambda - 1 );
+            sum += info->xsectScatNonBragg( NC::NeutronWavelength{ lambda } ).dbl();
+          }
+        } );
+        JSONLine("xsect").add("file",baseName(fn))
+          .add("bkgdmodel",NCP::nxsBkgdModelName(bkgdmodel)).add(m,nlambda)
+          .add("checksum",sum/m.reps);
+      }
+    }
+
+    //Background kernel versus lookups in a (temperature, wavelength) table at
+    //a fixed temperature, as done for each material when tables are enabled
+    //with NCRYSTAL_NXSLIB_BKGDTABLE:
+    for ( auto& fn : dataFiles() ) {
+      NXSCell cell( fn, 0 );
+      constexpr auto bkgdmodel = NCP::NXSBkgdModel::NXSG4;
+      const double inv_natoms = 1.0 / cell.uc.nAtoms;
+      const NCP::NXSBkgdKernel kernel( cell.uc, bkgdmodel );
+      NCP::StageTimer timer;
+      const NCP::NXSBkgdTable table( cell.uc, bkgdmodel, NCP::NXSBkgdTable::Grid() );
+      const double tbuild = timer.lap();
+      const auto tw = table.temperatureWeights( cell.uc.temperature );
+      double sum = 0.0;
+      auto m = measure( [&kernel,inv_natoms,&sum]()
+      {
+        for ( unsigned i = 0; i < nlambda; ++i ) {
+          const double xs = kernel.eval<NCP::NXSBkgdModel::NXSG4>( 0.1 + 9.9 * i / ( nlambda - 1 ) ) * inv_natoms;
+          sum += ( xs > 0.0 ? xs : 0.0 );
+        }
+      } );
+      const double checksum_kernel = sum / m.reps;
+      JSONLine("xsect").add("case","bkgd_kernel").add("file",baseName(fn))
+        .add("bkgdmodel",NCP::nxsBkgdModelName(bkgdmodel)).add(m,nlambda)
+        .add("checksum",checksum_kernel);
+      sum = 0.0;
+      auto m2 = measure( [&table,&tw,&sum]()
+      {
+        for ( unsigned i = 0; i < nlambda; ++i )
+          sum += table.xsect( tw, 0.1 + 9.9 * i / ( nlambda - 1 ) );
+      } );
+      JSONLine("xsect").add("case","bkgd_table").add("file",baseName(fn))
+        .add("bkgdmodel",NCP::nxsBkgdModelName(bkgdmodel)).add(m2,nlambda)
+        .add("checksum",sum/m2.reps)
+        .add("speedup",( m.time / m.reps ) / ( m2.time / m2.reps ))
+        .add("build_time",tbuild).add("bytes",table.memoryUsage());
+    }
+  }
+
+  void benchEdges()
+  {
+    const unsigned nlambda = 100000;
+    std::vector<double> lambdas, xs( nlambda );
+    for ( unsigned i = 0; i < nlambda; ++i )
+      lambdas.push_back( 0.5 + 9.5 * i / ( nlambda - 1 ) );
+    for ( auto& fn : dataFiles() ) {
+      NXSCell cell( fn, 10 );
+      cell.initHKL();
+      double sum = 0.0;
+      auto m = measure( [&cell,&lambdas,&sum]()
+      {
+        for ( auto l : lambdas )
+          sum += nxs::nxs_CoherentElastic( l, &cell.uc );
+      } );
+      JSONLine("edges").add("case","pointwise").add("file",baseName(fn))
+        .add("nhkl",cell.uc.nHKL).add(m,nlambda).add("checksum",sum/m.reps);
+      for ( unsigned nthreads : { 1u, 0u } ) {
+        sum = 0.0;
+        auto m2 = measure( [&cell,&lambdas,&xs,&sum,nthreads]()
+        {
+          NCP::coherentElasticSpectrum( cell.uc, lambdas.size(), lambdas.data(), xs.data(), nthreads );
+          for ( auto x : xs )
+            sum += x;
+        } );
+        JSONLine("edges").add("case",nthreads==1?"sweep":"sweep_parallel").add("file",baseName(fn))
+          .add("nhkl",cell.uc.nHKL).add(m2,nlambda).add("checksum",sum/m2.reps);
+      }
+      NCP::NXSCompactHKL compact( cell.uc );
+      for ( unsigned nthreads : { 1u, 0u } ) {
+        sum = 0.0;
+        auto m2 = measure( [&compact,&lambdas,&xs,&sum,nthreads]()
+        {
+          NCP::coherentElasticSpectrum( compact, lambdas.size(), lambdas.data(), xs.data(), nthreads );
+          for ( auto x : xs )
+            sum += x;
+        } );
+        JSONLine("edges").add("case",nthreads==1?"sweep_compact":"sweep_compact_parallel").add("file",baseName(fn))
+          .add("nhkl",cell.uc.nHKL).add(m2,nlambda).add("checksum",sum/m2.reps)
+          .add("bytes",compact.memoryUsage());
+      }
+    }
+  }
+
+}
+
+int main( int argc, char** argv )
+{
+  std::vector<std::string> suites;
+  for ( int i = 1; i < argc; ++i )
+    suites.emplace_back( argv[i] );
+  if ( suites.size() == 2 && suites.front() == "gen" ) {
+    for ( auto& fn : writeSyntheticFiles( suites.back() ) )
+      std::cout << fn << std::endl;
+    return 0;
+  }
+  if ( suites.empty() )
+    suites = { "load", "hkl", "xsect", "edges", "scaling", "threads" };
+  for ( auto& s : suites ) {
+    if ( s == "load" )
+      benchLoad();
+    else if ( s == "hkl" )
+      benchHKL();
+    else if ( s == "xsect" )
+      benchXSect();
+    else if ( s == "edges" )
+      benchEdges();
+    else if ( s == "scaling" )
+      benchScaling();
+    else if ( s == "threads" ) {
+      if ( !benchThreads() ) {
+        std::cerr << "Results of concurrent loading differ from those of serial loading!" << std::endl;
+        return 1;
+      }
+    }
+    else {
+      std::cerr << "Unknown benchmark suite: " << s << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -22,100 +22,61 @@
 #include "NCrystal/internal/utils/NCMath.hh"
 #include "NCrystal/internal/utils/NCAtomUtils.hh"
 #include "NCrystal/internal/utils/NCLatticeUtils.hh"
+#include "NCrystal/internal/utils/NCString.hh"
 #include "NCNXSLib.hh"
+#include "NCNXSBkgdScatter.hh"
+#include "NCNXSFSquare.hh"
+#include "NCNXSHKLCache.hh"
+#include "NCNXSHKLTools.hh"
+#include "NCNXSLoadStats.hh"
+#include "NCNXSParse.hh"
+#include "NCNXSTexture.hh"
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
 
 namespace NC = NCrystal;
 
 namespace NCPluginNamespace {
-  struct FakeFileForNXSLoader {
-    //Trying to mimic the behaviour of the fgets C-function, so we can load in-memory .nxs files
-    FakeFileForNXSLoader( const NC::TextData& td ) : m_it(td.begin()), m_itE(td.end()), m_dataDescr(td.dataSourceName()) {}
-    NC::TextData::Iterator m_it;
-    NC::TextData::Iterator m_itE;
-    NC::DataSourceName m_dataDescr;
-  };
-  //Need to pass function pointer to C code. Thus we use a global function with
-  //static data, and protect usage with a mutex:
-  static FakeFileForNXSLoader * s_fakeFileForNXSLoader = nullptr;
-  static std::mutex s_fakeFileForNXSLoader_mtx;
-  char* fake_fgets_for_nxs( char* str,int count )
-  {
-    nc_assert(s_fakeFileForNXSLoader);
-    auto& FF = *s_fakeFileForNXSLoader;
-    nc_assert(count>=3);
-    nc_assert(count<=1000000000);
-    if ( FF.m_it == FF.m_itE ) {
-      str[0] = '\0';
-      return nullptr;
-    }
-    const std::string& nextLine = *FF.m_it;
-    //std::fgets expected behaviour:
-    //   Reads at most count - 1 characters from the given file stream and
-    //   stores them in the character array pointed to by str. Parsing stops if
-    //   a newline character is found, in which case str will contain that
-    //   newline character, or if end-of-file occurs. If bytes are read and no
-    //   errors occur, writes a null character at the position immediately after
-    //   the last character written to str.
-    //
-    //Note that nextLine does NOT contain a newline character.
-    const std::size_t n = FF.m_it->size();
-    if  ( n+2 >= static_cast<std::size_t>(count) )
-      NCRYSTAL_THROW2(DataLoadError,"Too long line encountered in .nxs input data: "<<FF.m_dataDescr);
-    std::memcpy( str, &nextLine[0], n );
-    str[n]='\n';
-    str[n+1]='\0';
-    ++FF.m_it;//advance to next line
-    return str;
-  }
-
   void initNXS( nxs::NXS_UnitCell* uc,
                 const NC::TextData& textData,
                 //const std::string& nxs_file,
                 double temperature_kelvin,
-                unsigned maxhkl,
-                bool fixpolyatom )
+                bool fixpolyatom,
+                NXSLoadStats& stats )
   {
-    const char * old_SgError = nxs::SgError;
-    nxs::SgError = 0;
-
-    nxs::NXS_AtomInfo *atomInfoList;
+    //Parses the data and initialises everything except the hkl lattice planes
+    //(which are only needed for Bragg diffraction, see initNXSHKL below).
+    StageTimer timer;
+    auto atomInfoList = parseNXSData( textData, *uc );
     const auto& dataDescr = textData.dataSourceName();
-    int numAtomInfos = 0;
-    {
-      FakeFileForNXSLoader fake( textData );
-      NCRYSTAL_LOCK_GUARD(s_fakeFileForNXSLoader_mtx);
-      s_fakeFileForNXSLoader = &fake;
-      numAtomInfos = nxs::nxs_readParameterFile( fake_fgets_for_nxs, uc, &atomInfoList);
-      s_fakeFileForNXSLoader = nullptr;
-    }
+    stats.timeParse = timer.lap();
 
-    // Alternatively, we could work with on-disk files like this:
-    // textData.verifyOnDiskFileUnchanged();
-    // int numAtomInfos = nxs::nxs_readParameterFile( nxs_file.c_str(), uc, &atomInfoList);
-    // textData.verifyOnDiskFileUnchanged();
+    const char * old_SgError = nxs::SgError;
+    nxs::SgError = 0;
 
-    if (numAtomInfos==NXS_ERROR_READINGFILE) {
-      NCRYSTAL_THROW2(DataLoadError,"Problems parsing input data: "<<dataDescr);
-      //Was (but now we provide the content in-memory, so actual errors are pure syntax errors now):
-      //NCRYSTAL_THROW2(FileNotFound,"Could not find and open input data: "<<dataDescr);
-    }
-    if (numAtomInfos<=0)
-      NCRYSTAL_THROW2(DataLoadError,
-                     "Could not read crystal information from data: "<<dataDescr);
     if( NXS_ERROR_OK != nxs::nxs_initUnitCell(uc) )
       NCRYSTAL_THROW2(DataLoadError,
                      "Could not initialise unit cell based on parameters in data: "<<dataDescr);
+    stats.timeUnitCell = timer.lap();
 
     uc->temperature = temperature_kelvin;
-    for( int i=0; i< numAtomInfos; i++ )
-      nxs::nxs_addAtomInfo( uc, atomInfoList[i] );
-    free(atomInfoList);
-    atomInfoList = 0;
-    uc->maxHKL_index = maxhkl;
+    {
+      nxs::NXS_AtomInfo ai;
+      std::memset( &ai, 0, sizeof(ai) );
+      for ( auto& site : atomInfoList ) {
+        site.fill( ai );
+        nxs::nxs_addAtomInfo( uc, ai );
+      }
+    }
     int fix_incoh_xs = ( fixpolyatom ? 1 : 0 );
-    nxs::nxs_initHKL( uc, fix_incoh_xs );
+    nxs::nxs_initAverageSigma( uc, fix_incoh_xs );
+    stats.timeAtoms = timer.lap();
+    stats.nAtomSites = static_cast<std::uint64_t>( atomInfoList.size() );
+    stats.nAtoms = uc->nAtoms;
     if (nxs::SgError) {
       nxs::SgError = old_SgError;
       NCRYSTAL_THROW2(DataLoadError,
@@ -130,7 +91,37 @@ namespace NCPluginNamespace {
     NC::checkAndCompleteLattice( uc->sgInfo.TabSgName->SgNumber, uc->a, uc->b, uc->c );
 
   }
-  void deinitNXS_partly(nxs::NXS_UnitCell*uc)
+
+  void initNXSHKL( nxs::NXS_UnitCell* uc,
+                   const NC::DataSourceName& dataDescr,
+                   unsigned maxhkl,
+                   NXSFSquareOptions fsquare_options )
+  {
+    //Enumerate hkl lattice planes on a unit cell already set up by initNXS
+    //(with structure factors evaluated by the engine selected in
+    //NCNXSFSquare.hh).
+    const char * old_SgError = nxs::SgError;
+    nxs::SgError = 0;
+    uc->maxHKL_index = maxhkl;
+    uc->calcFSquareList = nxsCalcFSquareList;
+    uc->calcFSquareListData = &fsquare_options;
+    const int ec = nxs::nxs_initHKLList( uc );
+    uc->calcFSquareList = nullptr;
+    uc->calcFSquareListData = nullptr;
+    if ( NXS_ERROR_OK != ec ) {
+      nxs::SgError = old_SgError;
+      NCRYSTAL_THROW2(CalcError,"Could not initialise hkl lattice planes for data: "<<dataDescr);
+    }
+    if (nxs::SgError) {
+      nxs::SgError = old_SgError;
+      NCRYSTAL_THROW2(DataLoadError,
+                      "Could not initialise hkl lattice planes from data \""<<dataDescr
+                      <<"\" due to NXS errors: \""<<nxs::SgError<<"\"");
+    }
+    nxs::SgError = old_SgError;
+  }
+
+  void deinitNXSHKL(nxs::NXS_UnitCell*uc)
   {
     if (!uc->hklList)
       return;
@@ -140,6 +131,14 @@ namespace NCPluginNamespace {
       free(it->equivHKL);
     free(uc->hklList);
     uc->hklList = 0;
+    free(uc->hklCumFMd);
+    uc->hklCumFMd = 0;
+    uc->nHKL = 0;
+  }
+  void deinitNXS_partly(nxs::NXS_UnitCell*uc)
+  {
+    deinitNXSHKL(uc);
+    //NB: Also needed when hkl planes were never initialised:
     free(uc->sgInfo.ListSeitzMx);
     uc->sgInfo.ListSeitzMx = 0;
   }
@@ -151,46 +150,201 @@ namespace NCPluginNamespace {
   }
 
   struct XSectProvider_NXS final : private NC::MoveOnly {
-    XSectProvider_NXS(bool bkgdlikemcstas)
-      : m_bkgdlikemcstas(bkgdlikemcstas)
+    XSectProvider_NXS()
     {
       std::memset(&nxs_uc,0,sizeof(nxs_uc));
     }
-    double xsectScatNonBragg(const double& lambda) const;
     ~XSectProvider_NXS()
     {
-      deinitNXS(&nxs_uc);
+      if ( base ) {
+        //The symmetry operations belong to the base:
+        deinitNXSHKL(&nxs_uc);
+        free(nxs_uc.atomInfoList);
+      } else {
+        deinitNXS(&nxs_uc);
+      }
     }
     nxs::NXS_UnitCell nxs_uc;
-  private:
-    bool m_bkgdlikemcstas;
+    //Only for unit cells set up by initNXSFromShared:
+    std::shared_ptr<const XSectProvider_NXS> base;
   };
-}
 
-double NCP::XSectProvider_NXS::xsectScatNonBragg(const double& lambda) const
-{
+  std::shared_ptr<const XSectProvider_NXS> getSharedNXSBase( std::uint64_t dataHash,
+                                                             const NC::TextData& textData,
+                                                             double temperature_kelvin,
+                                                             bool fixpolyatom,
+                                                             NXSLoadStats& stats )
+  {
+    using Key = std::pair<std::uint64_t,bool>;
+    static std::mutex s_mtx;
+    static std::map<Key,std::weak_ptr<const XSectProvider_NXS>> s_bases;
+    const Key key{ dataHash, fixpolyatom };
+    {
+      NCRYSTAL_LOCK_GUARD(s_mtx);
+      auto it = s_bases.find( key );
+      if ( it != s_bases.end() ) {
+        auto base = it->second.lock();
+        if ( base )
+          return base;
+      }
+    }
+    //Set up outside the lock (as for getSharedBkgdTable):
+    auto newbase = std::make_shared<XSectProvider_NXS>();
+    initNXS( &newbase->nxs_uc, textData, temperature_kelvin, fixpolyatom, stats );
+    NCRYSTAL_LOCK_GUARD(s_mtx);
+    auto& entry = s_bases[key];
+    auto existing = entry.lock();
+    if ( existing )
+      return existing;
+    entry = newbase;
+    //Forget expired entries:
+    for ( auto it = s_bases.begin(); it != s_bases.end(); ) {
+      if ( it->second.expired() )
+        it = s_bases.erase( it );
+      else
+        ++it;
+    }
+    return newbase;
+  }
 
-  nxs::NXS_UnitCell* ucpar = const_cast<nxs::NXS_UnitCell*>(&nxs_uc);
-  double xsect_cell;
-  if ( m_bkgdlikemcstas )
-    xsect_cell = ( nxs::nxs_IncoherentElastic(lambda, ucpar )
-                   + nxs::nxs_IncoherentInelastic(lambda, ucpar )
-                   + nxs::nxs_CoherentInelastic(lambda, ucpar ) );
-  else
-    xsect_cell = ( nxs::nxs_SinglePhonon(lambda, ucpar )
-                   + nxs::nxs_MultiPhonon_COMBINED(lambda, ucpar )
-                   + nxs::nxs_IncoherentElastic(lambda, ucpar ) );
-  return xsect_cell > 0.0 ? xsect_cell / nxs_uc.nAtoms : 0.0;//protect against negative numbers and NaNs propagating from nxslib code.
+  void initNXSFromShared( XSectProvider_NXS& xsprov,
+                          std::uint64_t dataHash,
+                          const NC::TextData& textData,
+                          double temperature_kelvin,
+                          bool fixpolyatom,
+                          NXSLoadStats& stats )
+  {
+    //Same result as initNXS, but for materials loaded at many temperatures
+    //(as with background tables, see NXSBkgdTable), the data is only parsed
+    //and set up once. Loads at other temperatures copy the unit cell (sharing
+    //the symmetry operations) and update the temperature dependent factors of
+    //their own copy of the atoms:
+    xsprov.base = getSharedNXSBase( dataHash, textData, temperature_kelvin, fixpolyatom, stats );
+    const nxs::NXS_UnitCell& base_uc = xsprov.base->nxs_uc;
+    nxs::NXS_UnitCell& uc = xsprov.nxs_uc;
+    uc = base_uc;
+    uc.atomInfoList = (nxs::NXS_AtomInfo*)malloc( sizeof(nxs::NXS_AtomInfo) * base_uc.nAtomInfo );
+    if ( !uc.atomInfoList )
+      NCRYSTAL_THROW(CalcError,"Could not allocate memory for atom info");
+    std::memcpy( uc.atomInfoList, base_uc.atomInfoList, sizeof(nxs::NXS_AtomInfo) * base_uc.nAtomInfo );
+    nxs::nxs_setTemperature( &uc, temperature_kelvin );
+    stats.nAtomSites = uc.nAtomInfo;
+    stats.nAtoms = uc.nAtoms;
+  }
+
+  NC::HKLList produceNXSHKLList( const nxs::NXS_UnitCell& nxs_uc_orig,
+                                 const NC::DataSourceName& dataDescr,
+                                 unsigned maxhkl,
+                                 NC::PairDD dspacingRange,
+                                 double fsquare_cut,
+                                 const NXSFSquareOptions& fsquare_options,
+                                 NXSLoadStats& stats )
+  {
+    //Work on a shallow copy, so the atom info and symmetry operations of the
+    //original unit cell (which are only read here) can be shared, while the
+    //hkl list created below is private:
+    nxs::NXS_UnitCell nxs_uc = nxs_uc_orig;
+    nxs_uc.hklList = 0;
+    nxs_uc.hklCumFMd = 0;
+    nxs_uc.nHKL = 0;
+    struct Guard {
+      nxs::NXS_UnitCell& uc;
+      ~Guard() { deinitNXSHKL(&uc); }
+    } guard{nxs_uc};
+    initNXSHKL( &nxs_uc, dataDescr, maxhkl, fsquare_options );
+    StageTimer timer;
+
+    fsquare_cut *= 100.0;//convert from barn to nxs units
+    NC::HKLList hklList;
+    hklList.reserve_hint( nxs_uc.nHKL );
+    nxs::NXS_HKL *it = &(nxs_uc.hklList[0]);
+    nxs::NXS_HKL *itE = it + nxs_uc.nHKL;
+    for (;it!=itE;++it) {
+      if(it->dhkl < dspacingRange.first || it->dhkl>dspacingRange.second) //cut off d-spacing
+        continue;
+      if(it->FSquare < fsquare_cut) //remove reflections with vanishing contribution (left due to rounding errors?)
+        continue;
+      NC::HKLInfo hi;
+      hi.hkl.h = it->h;
+      hi.hkl.k = it->k;
+      hi.hkl.l = it->l;
+      hi.multiplicity = it->multiplicity;
+      hi.dspacing = it->dhkl;
+      hi.fsquared = 0.01 * it->FSquare;
+      //Pass on the symmetry equivalent planes already found by nxslib, so they
+      //do not have to be expanded again by NCrystal for oriented use. Like
+      //NCrystal, nxslib lists only one of each (h,k,l),(-h,-k,-l) pair:
+      if ( it->nEquivHKL * 2 != it->multiplicity )
+        NCRYSTAL_THROW2(BadInput,"Inconsistent symmetry equivalent planes of hkl=("
+                        <<it->h<<","<<it->k<<","<<it->l<<") in data "<<dataDescr
+                        <<" (nxslib found "<<it->nEquivHKL<<" for multiplicity "<<it->multiplicity<<")");
+      hi.explicitValues = std::make_unique<NC::HKLInfo::ExplicitVals>();
+      hi.explicitValues->list.reserve( it->nEquivHKL );
+      for ( unsigned j = 0; j < it->nEquivHKL; ++j )
+        hi.explicitValues->list.push_back( NC::HKL{ it->equivHKL[j].h, it->equivHKL[j].k, it->equivHKL[j].l } );
+      hklList.push_back( std::move(hi) );
+    }
+    const auto& hs = nxs_uc.hklStats;
+    stats.timeHKLEnumerate = hs.timeEnumerate;
+    stats.timeHKLEquiv = hs.timeEquivHKL;
+    stats.timeHKLDspacing = hs.timeDhkl;
+    stats.timeHKLFSquare = hs.timeFSquare;
+    stats.timeHKLSort = hs.timeSort;
+    stats.timeHKLConvert = timer.lap();
+    stats.nHKLCandidates = hs.nCandidates;
+    stats.nHKLNotSysAbsent = hs.nNotSysAbsent;
+    stats.nHKLSymEquivTests = hs.nSymEquivTests;
+    stats.nHKLUnique = nxs_uc.nHKL;
+    stats.nHKLKept = hklList.size();
+    stats.bytesAllocated = hs.bytesAllocated;
+    //We used to emit a warning here, but decided not to (user should be allowed
+    //to deliberately exclude all bragg edges via the dcutoff parameter without
+    //getting warnings):
+    // if (hklList.empty())
+    //   printf("NCrystal::loadNXSCrystal WARNING: No HKL planes selected from file \"%s\"\n",nxs_file);
+    return hklList;
+  }
 }
 
 NC::InfoBuilder::SinglePhaseBuilder NCP::loadNXSCrystal( const NC::TextData& textData,
                                                          NC::Temperature temperature,
                                                          double dcutoff_lower_aa,
                                                          double dcutoff_upper_aa,
-                                                         bool bkgdlikemcstas,
-                                                         bool fixpolyatom )
+                                                         NC::Optional<NXSBkgdModel> opt_bkgdmodel,
+                                                         NC::Optional<bool> opt_fixpolyatom )
 {
   const auto& dataDescr = textData.dataSourceName();
+  StageTimer timer_total;
+
+  //Background settings not given explicitly are taken from the data:
+  auto singleKeyValue = [&textData,&dataDescr]( const char * key ) -> NC::Optional<std::string>
+  {
+    auto values = nxsKeyValues( textData, key );
+    if ( values.size() > 1 )
+      NCRYSTAL_THROW2(DataLoadError,"Multiple \""<<key<<"\" entries in data: "<<dataDescr);
+    if ( values.empty() )
+      return NC::NullOpt;
+    return NC::trim2( values.front() );
+  };
+  NXSBkgdModel bkgdmodel = NXSBkgdModel::NXSG4;
+  if ( opt_bkgdmodel.has_value() ) {
+    bkgdmodel = opt_bkgdmodel.value();
+  } else {
+    auto v = singleKeyValue("bkgd_model");
+    if ( v.has_value() )
+      bkgdmodel = parseNXSBkgdModel( v.value() );
+  }
+  bool fixpolyatom = false;
+  if ( opt_fixpolyatom.has_value() ) {
+    fixpolyatom = opt_fixpolyatom.value();
+  } else {
+    auto v = singleKeyValue("bkgd_fixpolyatom");
+    if ( v.has_value() ) {
+      if ( v.value() != "0" && v.value() != "1" )
+        NCRYSTAL_THROW2(DataLoadError,"Invalid value of bkgd_fixpolyatom (must be 0 or 1) in data: "<<dataDescr);
+      fixpolyatom = ( v.value() == "1" );
+    }
+  }
 
   const bool verbose = (std::getenv("NCRYSTAL_DEBUGINFO") ? true : false);
   if (verbose)
@@ -198,7 +352,7 @@ NC::InfoBuilder::SinglePhaseBuilder NCP::loadNXSCrystal( const NC::TextData& tex
              <<", temp="<<temperature
              <<", dcutoff="<<dcutoff_lower_aa
              <<", dcutoffup="<<dcutoff_upper_aa
-             <<", bkgdlikemcstas="<<bkgdlikemcstas
+             <<", bkgdmodel="<<nxsBkgdModelName(bkgdmodel)
              <<", fixpolyatom="<<fixpolyatom
              <<")"<<std::endl;
 
@@ -208,30 +362,43 @@ NC::InfoBuilder::SinglePhaseBuilder NCP::loadNXSCrystal( const NC::TextData& tex
 
   NC::InfoBuilder::SinglePhaseBuilder builder;
 
-  //////////////////////////////////////////////////////////////////
-  // Load and init NXS info (twice to figure out adequate maxhkl) //
-  //////////////////////////////////////////////////////////////////
+  ////////////////////////////
+  // Load and init NXS info //
+  ////////////////////////////
 
   struct NXSXSectProviderWrapper {
-    //Dummy struct needed since std::function can only accept copy-able function
-    //objects.
+    //Objects which must live as long as the Info object, held by (copy-able)
+    //shared pointers in its background cross section provider below.
     std::shared_ptr<XSectProvider_NXS> shptr_xsprov_nxs;
-    NC::CrossSect operator()(NC::NeutronEnergy ekin) const { nc_assert(!!shptr_xsprov_nxs); return NC::CrossSect{ shptr_xsprov_nxs->xsectScatNonBragg(ekin.wavelength().dbl()) }; }
+    //Background source, also used by the scatter process of BkgdFactory:
+    std::shared_ptr<const NXSBkgdSource> bkgd;
+    //Texture model source (see NXSTextureSource):
+    std::shared_ptr<const NXSTextureSource> texturesource;
   };
 
-  NXSXSectProviderWrapper xsect_provider{std::make_shared<XSectProvider_NXS>(bkgdlikemcstas)};
+  NXSXSectProviderWrapper xsect_provider{std::make_shared<XSectProvider_NXS>()};
   nxs::NXS_UnitCell& nxs_uc = xsect_provider.shptr_xsprov_nxs->nxs_uc;
 
-  const double fsquare_cut = 100.0 * 1e-5 ;//remove reflections with vanishing contribution
-                                           //(NB: Hardcoded to same value as in .ncmat factory).
-                                           //factor 100.0 is to convert to nxs units.
-
-  int maxhkl = 1;
   if (verbose)
-    std::cout<<"NCrystal::NCNXSFactory::calling nxslib initHKL with maxhkl="<<maxhkl<<" (to init non-hkl info)"<<std::endl;
-  initNXS(&nxs_uc, textData, temperature.get(), maxhkl, fixpolyatom);
+    std::cout<<"NCrystal::NCNXSFactory::initialising non-hkl info"<<std::endl;
+  NXSLoadStats stats;
+  stats.kind = "info";
+  stats.dataSourceName = dataDescr.str();
+  stats.temperature = temperature.get();
+  //Background tables are meant for materials used at many temperatures, in
+  //which case the unit cell is shared between the loads:
+  auto bkgdTableGrid = NXSBkgdTable::gridFromEnv();
+  const std::uint64_t bkgdDataHash = ( bkgdTableGrid.has_value() ? hashTextData( textData ) : 0 );
+  if ( bkgdTableGrid.has_value() )
+    initNXSFromShared( *xsect_provider.shptr_xsprov_nxs, bkgdDataHash, textData,
+                       temperature.get(), fixpolyatom, stats );
+  else
+    initNXS(&nxs_uc, textData, temperature.get(), fixpolyatom, stats);
 
+  //The hkl lattice planes are only needed for Bragg diffraction, so the
+  //(expensive) enumeration is skipped entirely when that is disabled:
   const bool enable_hkl(dcutoff_lower_aa!=-1);
+  unsigned maxhkl = 0;
   if (enable_hkl) {
     auto maxHKLFromDCut = [&nxs_uc]( double dcut )
     {
@@ -261,52 +428,144 @@ NC::InfoBuilder::SinglePhaseBuilder NCP::loadNXSCrystal( const NC::TextData& tex
         std::cout<<"NCrystal::NCNXSFactory::automatically selected dcutoff level "<< dcutoff_lower_aa << " Aa"<<cmt<<std::endl;
     }
 
-    maxhkl = maxHKLFromDCut( dcutoff_lower_aa );
+    const int maxhkl_needed = maxHKLFromDCut( dcutoff_lower_aa );
 
-    deinitNXS(&nxs_uc);
-    if (maxhkl>50)
+    if (maxhkl_needed>50)
       NCRYSTAL_THROW2(CalcError,"Combinatorics too great to reach requested dcutoff = "<<dcutoff_lower_aa<<" Aa");
-
+    maxhkl = static_cast<unsigned>( maxhkl_needed );
+  }
+  stats.dcutoff = dcutoff_lower_aa;
+  stats.dcutoffup = dcutoff_upper_aa;
+  stats.maxhkl = maxhkl;
+
+  //Optionally use a background table shared by all temperatures:
+  std::shared_ptr<const NXSBkgdTable> bkgdtable;
+  if ( bkgdTableGrid.has_value()
+       && nxs_uc.temperature >= bkgdTableGrid.value().tmin
+       && nxs_uc.temperature <= bkgdTableGrid.value().tmax ) {
+    bkgdtable = getSharedBkgdTable( bkgdDataHash, bkgdmodel, fixpolyatom,
+                                    nxs_uc, bkgdTableGrid.value() );
+    if (verbose)
+      std::cout<<"NCrystal::NCNXSFactory::using shared background table ("
+               <<bkgdtable->memoryUsage()<<" bytes)"<<std::endl;
+  }
+  xsect_provider.bkgd = makeNXSBkgdSource( NXSBkgdKernel( nxs_uc, bkgdmodel ),
+                                           nxs_uc.nAtoms, nxs_uc.temperature,
+                                           std::move(bkgdtable) );
+
+  //The background is also available as a scatter process of its own (see
+  //BkgdFactory), which finds the source via a custom section:
+  builder.customData.emplace_back( "NXSBKGD", NC::Info::CustomSectionData{
+      registryIdLine( bkgdSourceRegistry().add( xsect_provider.bkgd ) ) } );
+
+  //Bragg diffraction of textured samples is provided by a separate scatter
+  //factory, which finds the (lazily created) texture model via a custom
+  //section:
+  auto textures = parseNXSTextures( textData );
+  if ( enable_hkl && !textures.empty() ) {
+    auto shptr_xsprov_nxs = xsect_provider.shptr_xsprov_nxs;
+    NC::PairDD dspacingRange{ dcutoff_lower_aa, dcutoff_upper_aa };
+    NC::DataSourceName tex_dataDescr = dataDescr;
+    xsect_provider.texturesource = std::make_shared<const NXSTextureSource>( [shptr_xsprov_nxs,tex_dataDescr,maxhkl,dspacingRange,textures]()
+    {
+      //Private hkl list, since the equivalent planes are needed:
+      nxs::NXS_UnitCell nxs_uc = shptr_xsprov_nxs->nxs_uc;
+      nxs_uc.hklList = 0;
+      nxs_uc.hklCumFMd = 0;
+      nxs_uc.nHKL = 0;
+      struct Guard {
+        nxs::NXS_UnitCell& uc;
+        ~Guard() { deinitNXSHKL(&uc); }
+      } guard{nxs_uc};
+      initNXSHKL( &nxs_uc, tex_dataDescr, maxhkl, NXSFSquareOptions::fromEnv() );
+      return std::make_shared<const NXSTextureModel>( nxs_uc, textures, dspacingRange );
+    } );
+    auto dblstr = []( double v ) { std::ostringstream ss; ss.precision(17); ss << v; return ss.str(); };
+    NC::Info::CustomSectionData section;
+    section.push_back( registryIdLine( textureSourceRegistry().add( xsect_provider.texturesource ) ) );
+    for ( auto& t : textures )
+      section.push_back( { std::to_string(t.a), std::to_string(t.b), std::to_string(t.c),
+                           dblstr(t.r), dblstr(t.f) } );
+    builder.customData.emplace_back( "NXSTEXTURE", std::move(section) );
     if (verbose)
-      std::cout<<"NCrystal::NCNXSFactory::calling nxslib initHKL with maxhkl="<<maxhkl
-               <<" (for all info including hkl)"<<std::endl;
-    initNXS(&nxs_uc, textData, temperature.get(), maxhkl, fixpolyatom );
+      std::cout<<"NCrystal::NCNXSFactory::found "<<textures.size()<<" texture specification(s)"<<std::endl;
   }
 
-  builder.bkgdxsectprovider  = xsect_provider;
+  //The background model is resolved here, once, so the provider calls the
+  //source of that model directly:
+  std::visit( [&builder,&xsect_provider]( const auto& bkgd )
+  {
+    const auto * src = &bkgd;
+    builder.bkgdxsectprovider = [owners = xsect_provider,src]( NC::NeutronEnergy ekin )
+    {
+      return NC::CrossSect{ src->xsectPerAtom( ekin.wavelength().dbl() ) };
+    };
+  }, *xsect_provider.bkgd );
 
   //////////////////////
   // ... add HKL info //
   //////////////////////
 
   if (enable_hkl) {
-    NC::HKLList hklList;
-    hklList.reserve_hint( nxs_uc.nHKL );
-    nxs::NXS_HKL *it = &(nxs_uc.hklList[0]);
-    nxs::NXS_HKL *itE = it + nxs_uc.nHKL;
-    for (;it!=itE;++it) {
-      if(it->dhkl < dcutoff_lower_aa || it->dhkl>dcutoff_upper_aa) //cut off d-spacing
-        continue;
-      if(it->FSquare < fsquare_cut) //remove reflections with vanishing contribution (left due to rounding errors?)
-        continue;
-      NC::HKLInfo hi;
-      hi.hkl.h = it->h;
-      hi.hkl.k = it->k;
-      hi.hkl.l = it->l;
-      hi.multiplicity = it->multiplicity;
-      hi.dspacing = it->dhkl;
-      hi.fsquared = 0.01 * it->FSquare;
-      hklList.push_back( std::move(hi) );
-    }
-    //We used to emit a warning here, but decided not to (user should be allowed
-    //to deliberately exclude all bragg edges via the dcutoff parameter without
-    //getting warnings):
-    // if (hklList.empty())
-    //   printf("NCrystal::loadNXSCrystal WARNING: No HKL planes selected from file \"%s\"\n",nxs_file);
-
+    //The hkl lattice planes (and in particular their structure factors) are
+    //only calculated when first requested, since many users of the Info object
+    //never need them. The resulting list is then cached by NCrystal:
     builder.hklPlanes.emplace();//Set up uninitialised HKLPlanes struct
     builder.hklPlanes.value().dspacingRange = { dcutoff_lower_aa, dcutoff_upper_aa  };
-    builder.hklPlanes.value().source = std::move(hklList);
+    auto shptr_xsprov_nxs = xsect_provider.shptr_xsprov_nxs;
+    NC::DataSourceName hkl_dataDescr = dataDescr;
+    //Optional cache shared with other processes on the same node (only needs
+    //the content hash of the input if enabled):
+    std::string cachedir = hklCacheDir();
+    const std::uint64_t dataHash = ( cachedir.empty() ? 0 : hashTextData( textData ) );
+    //Optional post-processing (the cache holds the lists without it):
+    const NXSHKLOptions hklopts = nxsHKLOptions( textData );
+    //The |F|^2 engine is part of the cache key, since it affects the values:
+    const NXSFSquareOptions fsqopts = NXSFSquareOptions::fromEnv();
+    NC::InfoBuilder::HKLPlanes::HKLListGenFct hklListGenFct
+      = [shptr_xsprov_nxs,hkl_dataDescr,maxhkl,verbose,cachedir,dataHash,hklopts,fsqopts]( const NC::StructureInfo*,
+                                                                                   const NC::AtomInfoList*,
+                                                                                   NC::PairDD dspacingRange )
+      {
+        StageTimer timer_hkl;
+        NXSLoadStats hklstats;
+        hklstats.kind = "hkl";
+        hklstats.dataSourceName = hkl_dataDescr.str();
+        hklstats.temperature = shptr_xsprov_nxs->nxs_uc.temperature;
+        hklstats.dcutoff = dspacingRange.first;
+        hklstats.dcutoffup = dspacingRange.second;
+        hklstats.maxhkl = maxhkl;
+        const HKLCacheKey cachekey{ dataHash, shptr_xsprov_nxs->nxs_uc.temperature, maxhkl, dspacingRange,
+                                    hklopts.fsquareCut, fsqopts };
+        if ( !cachedir.empty() ) {
+          auto cached = hklCacheLoad( cachedir, cachekey );
+          if ( cached.has_value() ) {
+            if (verbose)
+              std::cout<<"NCrystal::NCNXSFactory::using hkl planes of "<<hkl_dataDescr
+                       <<" from cache in "<<cachedir<<std::endl;
+            hklstats.fromCache = true;
+            hklstats.nHKLKept = cached.value().size();
+            auto hklList = applyHKLOptions( std::move(cached.value()), hklopts );
+            hklstats.nHKLEmitted = hklList.size();
+            hklstats.timeTotal = timer_hkl.lap();
+            registerLoadStats( std::move(hklstats) );
+            return hklList;
+          }
+        }
+        if (verbose)
+          std::cout<<"NCrystal::NCNXSFactory::calling nxslib initHKLList with maxhkl="<<maxhkl
+                   <<" (deferred until hkl planes of "<<hkl_dataDescr<<" were requested)"<<std::endl;
+        auto hklList = produceNXSHKLList( shptr_xsprov_nxs->nxs_uc, hkl_dataDescr, maxhkl, dspacingRange,
+                                          hklopts.fsquareCut, fsqopts, hklstats );
+        if ( !cachedir.empty() )
+          hklCacheStore( cachedir, cachekey, hklList );
+        hklList = applyHKLOptions( std::move(hklList), hklopts );
+        hklstats.nHKLEmitted = hklList.size();
+        hklstats.timeTotal = timer_hkl.lap();
+        registerLoadStats( std::move(hklstats) );
+        return hklList;
+      };
+    builder.hklPlanes.value().source = std::move(hklListGenFct);
   }
 
   ////////////////////////////
@@ -422,9 +681,25 @@ NC::InfoBuilder::SinglePhaseBuilder NCP::loadNXSCrystal( const NC::TextData& tex
   // Done! //
   ///////////
 
-  //A bit dirty, but we don't really need to keep the hkllist around from this
-  //point on, so might as well save some memory:
-  deinitNXS_partly(&nxs_uc);
+  stats.timeTotal = timer_total.lap();
+  if (verbose)
+    std::cout<<"NCrystal::NCNXSFactory::load stats: "<<stats.toJSON()<<std::endl;
+  registerLoadStats( std::move(stats) );
+
+  //NB: We do not free the symmetry operations in nxs_uc here, since they are
+  //needed if and when the hkl planes are produced.
 
   return builder;
 }
+
+std::vector<std::string> NCP::nxsKeyValues( const NC::TextData& textData, const std::string& key )
+{
+  //Same key=value syntax as in nxs_readParameterFile:
+  std::vector<std::string> res;
+  for ( const std::string& line : textData ) {
+    auto parts = NC::split2( line.substr( 0, line.find_first_of("#!;") ), 1, '=' );
+    if ( parts.size() == 2 && NC::trim2( parts.at(0) ) == key )
+      res.push_back( std::move( parts.at(1) ) );
+  }
+  return res;
+}
@@ -23,6 +23,7 @@
 
 #include "NCrystal/NCPluginBoilerplate.hh"
 #include "NCrystal/internal/infobld/NCInfoBuilder.hh"
+#include "NCNXSBkgdModel.hh"
 
 namespace NCPluginNamespace {
 
@@ -30,9 +31,13 @@ namespace NCPluginNamespace {
                                                       NC::Temperature,
                                                       double dcutoff_low_aa,
                                                       double dcutoff_upper_aa,
-                                                      bool bkgdlikemcstas=false,//compose background curve as done in McStas
-                                                                                //Sample_nxs.comp rather than as in NXSG4.
-                                                      bool fixpolyatom=false//upstream nxslib
+                                                      //Background model (see NCNXSBkgdModel.hh). If not
+                                                      //set, the "bkgd_model" key of the data is used
+                                                      //(default nxsg4):
+                                                      NC::Optional<NXSBkgdModel> bkgdmodel = NC::NullOpt,
+                                                      //If not set, the "bkgd_fixpolyatom" key of the
+                                                      //data is used (default false):
+                                                      NC::Optional<bool> fixpolyatom = NC::NullOpt//upstream nxslib
                                                                   //overestimates
                                                                   //incoherent xsect of
                                                                   //polyatomic crystals at
@@ -44,6 +49,10 @@ namespace NCPluginNamespace {
                                                                   //wavelengths).
                                                   );
 
+  //Values of all "key = value" lines in .nxs data with the given key (which
+  //nxslib itself ignores unless it is one of its own keys):
+  std::vector<std::string> nxsKeyValues( const NC::TextData&, const std::string& key );
+
 }
 
 #endif
@@ -0,0 +1,176 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCNXSBatchLoad.hh"
+#include "NCrystal/internal/utils/NCMsg.hh"
+#include "NCrystal/internal/utils/NCString.hh"
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+
+namespace NC = NCrystal;
+
+struct NCP::NXSBatchLoader::State {
+  std::vector<std::string> cfgstrs;
+  std::vector<std::promise<NC::InfoPtr>> promises;
+  Callback callback;
+  std::atomic<std::size_t> next{0};
+  std::atomic<bool> cancelled{false};
+
+  void work()
+  {
+    //Requests are handed out one at a time, so a few expensive materials do
+    //not hold up the rest of the batch:
+    const std::size_t n = cfgstrs.size();
+    for ( std::size_t idx = next++; idx < n; idx = next++ ) {
+      if ( cancelled ) {
+        try {
+          NCRYSTAL_THROW2(CalcError,"Loading of \""<<cfgstrs.at(idx)<<"\" was cancelled");
+        } catch (...) {
+          promises.at(idx).set_exception( std::current_exception() );
+        }
+        continue;
+      }
+      NC::InfoPtr info;
+      std::exception_ptr error;
+      try {
+        info = NC::createInfo( cfgstrs.at(idx) );
+      } catch (...) {
+        error = std::current_exception();
+      }
+      if ( error )
+        promises.at(idx).set_exception( error );
+      else
+        promises.at(idx).set_value( info );
+      if ( callback )
+        callback( idx, std::move(info), error );
+    }
+  }
+};
+
+NCP::NXSBatchLoader::NXSBatchLoader( std::vector<std::string> cfgstrs,
+                                     unsigned nthreads,
+                                     Callback callback )
+  : m_state(std::make_shared<State>())
+{
+  const std::size_t n = cfgstrs.size();
+  m_state->cfgstrs = std::move(cfgstrs);
+  m_state->promises.resize( n );
+  m_state->callback = std::move(callback);
+  m_futures.reserve( n );
+  for ( auto& p : m_state->promises )
+    m_futures.push_back( p.get_future().share() );
+
+  if ( nthreads == 0 )
+    nthreads = std::max<unsigned>( 1, std::thread::hardware_concurrency() );
+  nthreads = static_cast<unsigned>( std::min<std::size_t>( nthreads, n ) );
+  m_workers.reserve( nthreads );
+  for ( unsigned i = 0; i < nthreads; ++i )
+    m_workers.emplace_back( [state = m_state]() { state->work(); } );
+}
+
+void NCP::NXSBatchLoader::wait()
+{
+  for ( auto& w : m_workers )
+    if ( w.joinable() )
+      w.join();
+}
+
+void NCP::NXSBatchLoader::cancel()
+{
+  m_state->cancelled = true;
+}
+
+NCP::NXSBatchLoader::~NXSBatchLoader()
+{
+  wait();
+}
+
+namespace NCPluginNamespace {
+  namespace {
+    class PrewarmLoaders final : private NC::NoCopyMove {
+    public:
+      PrewarmLoaders() = default;
+      ~PrewarmLoaders()
+      {
+        //At exit, skip what was not started yet and join the workers, so they
+        //do not outlive the plugin (or the NCrystal objects they use):
+        NCRYSTAL_LOCK_GUARD(m_mtx);
+        for ( auto& l : m_loaders )
+          l->cancel();
+        m_loaders.clear();
+      }
+      void add( std::unique_ptr<NXSBatchLoader> loader )
+      {
+        NCRYSTAL_LOCK_GUARD(m_mtx);
+        m_loaders.push_back( std::move(loader) );
+      }
+    private:
+      std::mutex m_mtx;
+      std::vector<std::unique_ptr<NXSBatchLoader>> m_loaders;
+    };
+
+    PrewarmLoaders& prewarmLoaders()
+    {
+      static PrewarmLoaders s_loaders;
+      return s_loaders;
+    }
+  }
+}
+
+void NCP::prewarmNXSMaterials( std::vector<std::string> cfgstrs, unsigned nthreads )
+{
+  if ( cfgstrs.empty() )
+    return;
+  for ( auto& c : cfgstrs )
+    if ( c.find("::") == std::string::npos )
+      c = std::string("plugins::") + pluginName() + "/" + c;
+  auto callback = []( std::size_t, NC::InfoPtr, std::exception_ptr error )
+  {
+    if ( !error )
+      return;
+    try {
+      std::rethrow_exception( error );
+    } catch ( std::exception& e ) {
+      NCRYSTAL_WARN("pre-warming of "<<pluginName()<<" material failed: "<<e.what());
+    } catch (...) {
+      NCRYSTAL_WARN("pre-warming of "<<pluginName()<<" material failed");
+    }
+  };
+  //Statics are destroyed in the reverse order of their construction, so the
+  //owner of the loaders (typically constructed after NCrystal was first used,
+  //see prewarmNXSMaterialsFromEnvOnce) is destroyed, and the workers joined,
+  //before the NCrystal caches used by the workers:
+  prewarmLoaders().add( std::make_unique<NXSBatchLoader>( std::move(cfgstrs), nthreads, callback ) );
+}
+
+std::vector<std::string> NCP::prewarmCfgsFromEnv()
+{
+  const char * ev = std::getenv("NCRYSTAL_NXSLIB_PREWARM");
+  if ( !ev )
+    return {};
+  return NC::split2( ev );
+}
+
+void NCP::prewarmNXSMaterialsFromEnvOnce()
+{
+  static std::once_flag s_once;
+  std::call_once( s_once, []() { prewarmNXSMaterials( prewarmCfgsFromEnv() ); } );
+}
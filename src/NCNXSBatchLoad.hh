@@ -0,0 +1,93 @@
+#ifndef NCPlugin_NXSBatchLoad_hh
+#define NCPlugin_NXSBatchLoad_hh
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCrystal/NCPluginBoilerplate.hh"
+#include <exception>
+#include <functional>
+#include <future>
+#include <thread>
+
+namespace NCPluginNamespace {
+
+  //Loads the Info objects of a list of cfg strings (typically all materials of
+  //a simulation, known before it starts) concurrently on a pool of worker
+  //threads, while the calling thread can continue with other work. Loading
+  //goes through NC::createInfo, so results end up in NCrystal's usual caches,
+  //and requests for the same material (also from outside the batch) are only
+  //loaded once. The optional callback is invoked from the worker threads when
+  //each request completes, with either the result or the exception thrown by
+  //the load (it must not throw itself). The destructor waits for all loads to
+  //complete. This is internal to the plugin (which is loaded as a module
+  //without installed headers), applications reach it via
+  //NCRYSTAL_NXSLIB_PREWARM.
+  class NXSBatchLoader final : private NC::NoCopyMove {
+  public:
+    using Callback = std::function<void(std::size_t idx, NC::InfoPtr, std::exception_ptr)>;
+
+    //nthreads=0 means one per hardware thread:
+    NXSBatchLoader( std::vector<std::string> cfgstrs,
+                    unsigned nthreads = 0,
+                    Callback callback = nullptr );
+    ~NXSBatchLoader();
+
+    std::size_t size() const { return m_futures.size(); }
+
+    //Result of request idx (get() rethrows any exception of the load):
+    const std::shared_future<NC::InfoPtr>& future( std::size_t idx ) const { return m_futures.at(idx); }
+
+    //Waits for all requests to complete (does not throw):
+    void wait();
+
+    //Requests not yet started are failed with an exception instead of being
+    //loaded (without invoking the callback). Loads in progress are completed:
+    void cancel();
+
+  private:
+    struct State;
+    std::shared_ptr<State> m_state;
+    std::vector<std::shared_future<NC::InfoPtr>> m_futures;
+    std::vector<std::thread> m_workers;
+  };
+
+  //Starts loading the given materials in the background (see
+  //NXSBatchLoader), keeping the results alive for the rest of the process, so
+  //that their first use is a cache hit. Bare file names without "::" are taken
+  //to refer to files bundled with the plugin (e.g. "Al_sg225.nxs;temp=77K").
+  //Failures are reported as NCrystal warnings. The loaders are owned by a
+  //static object, which at exit cancels the loads not yet started and waits
+  //for those in progress. Internal, applications use NCRYSTAL_NXSLIB_PREWARM:
+  void prewarmNXSMaterials( std::vector<std::string> cfgstrs, unsigned nthreads = 0 );
+
+  //Materials to pre-warm: the whitespace separated entries of the
+  //NCRYSTAL_NXSLIB_PREWARM environment variable, if set:
+  std::vector<std::string> prewarmCfgsFromEnv();
+
+  //Pre-warms the materials of prewarmCfgsFromEnv the first time it is called
+  //(later calls do nothing). This is done by the plugin's factory when it
+  //first loads a material, rather than on plugin registration, which should
+  //not start any threads:
+  void prewarmNXSMaterialsFromEnvOnce();
+
+}
+
+#endif
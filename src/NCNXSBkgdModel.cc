@@ -0,0 +1,73 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCNXSBkgdModel.hh"
+#include <cmath>
+
+namespace NC = NCrystal;
+
+NCP::NXSBkgdModel NCP::parseNXSBkgdModel( const std::string& name )
+{
+  for ( auto m : { NXSBkgdModel::NXSG4, NXSBkgdModel::NXSG4_Cassels,
+                   NXSBkgdModel::NXSG4_Freund, NXSBkgdModel::McStas } )
+    if ( name == nxsBkgdModelName( m ) )
+      return m;
+  NCRYSTAL_THROW2(BadInput,"Unknown nxs background model \""<<name
+                  <<"\" (must be one of nxsg4, nxsg4_cassels, nxsg4_freund or mcstas)");
+}
+
+const char * NCP::nxsBkgdModelName( NXSBkgdModel m )
+{
+  switch ( m ) {
+  case NXSBkgdModel::NXSG4: return "nxsg4";
+  case NXSBkgdModel::NXSG4_Cassels: return "nxsg4_cassels";
+  case NXSBkgdModel::NXSG4_Freund: return "nxsg4_freund";
+  case NXSBkgdModel::McStas: return "mcstas";
+  }
+  nc_assert_always(false);
+  return "";
+}
+
+NCP::NXSBkgdKernel::NXSBkgdKernel( const nxs::NXS_UnitCell& uc, NXSBkgdModel model )
+  : m_sigmaInc( uc.avgSigmaIncoherent ),
+    m_sigmaCoh( uc.avgSigmaCoherent ),
+    m_model( model )
+{
+  //Constants as in the corresponding nxslib functions:
+  const double ekin_times_lambdasq = 8.18042531017E-2;
+  double sph = 0.0;
+  m_sites.reserve( uc.nAtomInfo );
+  for ( unsigned i = 0; i < uc.nAtomInfo; ++i ) {
+    const auto& ai = uc.atomInfoList[i];
+    const double A = ai.M_m;
+    Site s;
+    s.nAtoms = ai.nAtoms;
+    s.inv2Biso = 0.5 / ai.B_iso;
+    s.massFact = A / ( A + 1.0 ) * A / ( A + 1.0 );
+    s.phiFact = 9.0 * ai.phi_1 * ai.phi_3 / A / A;
+    s.freundFact = ai.B_iso * uc.mph_c2 * ekin_times_lambdasq;
+    m_sites.push_back( s );
+    sph += ai.sph * ai.nAtoms;
+  }
+  m_sphFact = sph * ( m_sigmaCoh + m_sigmaInc ) / 35.90806936252971 / std::sqrt( ekin_times_lambdasq );
+  const double lambda_debye = 30.8106673293723 / std::sqrt( uc.debyeTemp );
+  m_lambdaCassels = lambda_debye * 1.78789683887;
+  m_lambdaFreund = lambda_debye * 3.68096408002;
+}
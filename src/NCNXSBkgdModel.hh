@@ -0,0 +1,154 @@
+#ifndef NCPlugin_NXSBkgdModel_hh
+#define NCPlugin_NXSBkgdModel_hh
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCrystal/NCPluginBoilerplate.hh"
+#include "NCNXSLib.hh"
+#include <cmath>
+#include <type_traits>
+
+namespace NCPluginNamespace {
+
+  //Models for the non-Bragg background cross section, composed of the nxslib
+  //functions as follows:
+  //
+  //  nxsg4         : SinglePhonon + MultiPhonon_COMBINED + IncoherentElastic (as in NXSG4, default)
+  //  nxsg4_cassels : SinglePhonon + MultiPhonon_CASSELS  + IncoherentElastic
+  //  nxsg4_freund  : SinglePhonon + MultiPhonon_FREUND   + IncoherentElastic
+  //  mcstas        : IncoherentElastic + IncoherentInelastic + CoherentInelastic
+  //                  (as in McStas' Sample_nxs.comp, i.e. the BINDER approach)
+  //
+  //The model can be selected for a given material with a "bkgd_model = <name>"
+  //line in the .nxs data (ignored by nxslib itself), since NCrystal cfg
+  //strings can not carry plugin specific parameters.
+  enum class NXSBkgdModel { NXSG4, NXSG4_Cassels, NXSG4_Freund, McStas };
+  NXSBkgdModel parseNXSBkgdModel( const std::string& );//throws BadInput
+  const char * nxsBkgdModelName( NXSBkgdModel );
+
+  //Calls fct with a std::integral_constant<NXSBkgdModel,...> of the given
+  //model, so callers can select their template specialisations once (e.g.
+  //when a process is created) rather than for each evaluation:
+  template<class TFct>
+  auto visitNXSBkgdModel( NXSBkgdModel m, TFct&& fct )
+    -> decltype( fct( std::integral_constant<NXSBkgdModel,NXSBkgdModel::NXSG4>() ) )
+  {
+    switch ( m ) {
+    case NXSBkgdModel::NXSG4_Cassels:
+      return fct( std::integral_constant<NXSBkgdModel,NXSBkgdModel::NXSG4_Cassels>() );
+    case NXSBkgdModel::NXSG4_Freund:
+      return fct( std::integral_constant<NXSBkgdModel,NXSBkgdModel::NXSG4_Freund>() );
+    case NXSBkgdModel::McStas:
+      return fct( std::integral_constant<NXSBkgdModel,NXSBkgdModel::McStas>() );
+    case NXSBkgdModel::NXSG4:
+      break;
+    }
+    return fct( std::integral_constant<NXSBkgdModel,NXSBkgdModel::NXSG4>() );
+  }
+
+  //Background cross section per unit cell [barn] of an initialised unit cell
+  //(all atoms added and nxs_initAverageSigma called). The per-site constants
+  //are extracted once, and each model is evaluated by its own template
+  //specialisation of eval, a single loop over the atom sites with all
+  //components fused (whereas e.g. nxs_MultiPhonon_COMBINED would evaluate
+  //both multi-phonon models in the blend region, each in a loop of its own).
+  //For nxsg4, the wavelength region of nxs_MultiPhonon_COMBINED is picked
+  //once per call, and each region has a loop of its own without branches.
+  //NB: Can be negative, callers must clamp at 0.
+  class NXSBkgdKernel final {
+  public:
+    NXSBkgdKernel( const nxs::NXS_UnitCell&, NXSBkgdModel );
+    NXSBkgdModel model() const { return m_model; }
+
+    //Evaluate model TModel, which must be model() (see visitNXSBkgdModel):
+    template<NXSBkgdModel TModel>
+    double eval( double lambda ) const;
+
+  private:
+    enum class Terms { Cassels, Freund, Blend, Binder };
+    template<Terms TTerms>
+    double sumSites( double lambda, double wCassels, double wFreund ) const;
+    struct Site {
+      double nAtoms;
+      double inv2Biso;//1/(2*B_iso)
+      double massFact;//(A/(A+1))^2
+      double phiFact;//9*phi_1*phi_3/A^2
+      double freundFact;//B_iso*mph_c2*E*lambda^2
+    };
+    std::vector<Site> m_sites;
+    double m_sigmaInc;
+    double m_sigmaCoh;
+    double m_sphFact;//single phonon cross section divided by lambda
+    double m_lambdaCassels;
+    double m_lambdaFreund;
+    NXSBkgdModel m_model;
+  };
+
+  template<NXSBkgdModel TModel>
+  inline double NXSBkgdKernel::eval( double lambda ) const
+  {
+    nc_assert( m_model == TModel );
+    if ( TModel == NXSBkgdModel::NXSG4_Cassels )
+      return sumSites<Terms::Cassels>( lambda, 1.0, 0.0 );
+    if ( TModel == NXSBkgdModel::NXSG4_Freund )
+      return sumSites<Terms::Freund>( lambda, 0.0, 1.0 );
+    if ( TModel == NXSBkgdModel::McStas )
+      return sumSites<Terms::Binder>( lambda, 0.0, 0.0 );
+    //nxsg4, with the linear switch-over of nxs_MultiPhonon_COMBINED:
+    if ( lambda <= m_lambdaCassels )
+      return sumSites<Terms::Cassels>( lambda, 1.0, 0.0 );
+    if ( lambda >= m_lambdaFreund )
+      return sumSites<Terms::Freund>( lambda, 0.0, 1.0 );
+    const double dl = m_lambdaFreund - m_lambdaCassels;
+    return sumSites<Terms::Blend>( lambda, ( m_lambdaFreund - lambda ) / dl, ( lambda - m_lambdaCassels ) / dl );
+  }
+
+  template<NXSBkgdKernel::Terms TTerms>
+  inline double NXSBkgdKernel::sumSites( double lambda, double wCassels, double wFreund ) const
+  {
+    const double lambdasq = lambda * lambda;
+    const double inv_lambdasq = 1.0 / lambdasq;
+    double sumEl = 0.0;//incoherent elastic (without sigma)
+    double sumInel = 0.0;//mcstas: BINDER inelastic, nxsg4*: multi-phonon (without sigma)
+    for ( const auto& s : m_sites ) {
+      const double v = lambdasq * s.inv2Biso;
+      const double sEl = v * ( 1.0 - std::exp( -1.0 / v ) );
+      sumEl += sEl * s.nAtoms;
+      if ( TTerms == Terms::Binder )
+        sumInel += ( s.massFact * ( 1.0 + s.phiFact * v ) - sEl ) * s.nAtoms;
+      else if ( TTerms == Terms::Cassels )
+        sumInel += s.massFact * ( 1.0 - sEl ) * s.nAtoms;
+      else if ( TTerms == Terms::Freund )
+        sumInel += s.massFact * ( 1.0 - std::exp( -s.freundFact * inv_lambdasq ) ) * s.nAtoms;
+      else
+        sumInel += s.massFact * ( wCassels * ( 1.0 - sEl )
+                                  + wFreund * ( 1.0 - std::exp( -s.freundFact * inv_lambdasq ) ) ) * s.nAtoms;
+    }
+    const double sigmaTot = m_sigmaCoh + m_sigmaInc;
+    if ( TTerms == Terms::Binder )
+      return sumEl * m_sigmaInc + sumInel * sigmaTot;
+    else
+      return m_sphFact * lambda + sumInel * sigmaTot + sumEl * m_sigmaInc;
+  }
+
+}
+
+#endif
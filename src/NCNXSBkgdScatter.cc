@@ -0,0 +1,43 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCNXSBkgdScatter.hh"
+
+namespace NC = NCrystal;
+
+NCP::SharedObjectRegistry<NCP::NXSBkgdSource>& NCP::bkgdSourceRegistry()
+{
+  static SharedObjectRegistry<NXSBkgdSource> s_reg;
+  return s_reg;
+}
+
+std::shared_ptr<const NCP::NXSBkgdSource> NCP::makeNXSBkgdSource( NXSBkgdKernel kernel,
+                                                                  unsigned natoms,
+                                                                  double temperature,
+                                                                  std::shared_ptr<const NXSBkgdTable> table )
+{
+  return visitNXSBkgdModel( kernel.model(), [&]( auto m )
+  {
+    using TSource = NXSBkgdSourceT<decltype(m)::value>;
+    return std::make_shared<const NXSBkgdSource>( std::in_place_type<TSource>,
+                                                  std::move(kernel), natoms, temperature,
+                                                  std::move(table) );
+  } );
+}
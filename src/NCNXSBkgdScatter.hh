@@ -0,0 +1,112 @@
+#ifndef NCPlugin_NXSBkgdScatter_hh
+#define NCPlugin_NXSBkgdScatter_hh
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCrystal/NCPluginBoilerplate.hh"
+#include "NCNXSBkgdModel.hh"
+#include "NCNXSBkgdTable.hh"
+#include "NCNXSRegistry.hh"
+#include <variant>
+
+namespace NCPluginNamespace {
+
+  //Background cross section per atom of a loaded material at its temperature,
+  //from the shared table if present and covering the point, and otherwise
+  //from the kernel (evaluating model TModel). The table must cover the
+  //temperature:
+  template<NXSBkgdModel TModel>
+  class NXSBkgdSourceT final {
+  public:
+    static constexpr NXSBkgdModel model = TModel;
+
+    NXSBkgdSourceT( NXSBkgdKernel kernel,
+                    unsigned natoms,
+                    double temperature,
+                    std::shared_ptr<const NXSBkgdTable> table = nullptr )
+      : m_kernel(std::move(kernel)),
+        m_invNAtoms(1.0/natoms),
+        m_table(std::move(table)),
+        m_tableWeights( m_table ? m_table->temperatureWeights( temperature )
+                        : NXSBkgdTable::TemperatureWeights{ 0, 0.0 } )
+    {
+      nc_assert_always( m_kernel.model() == TModel );
+    }
+
+    double xsectPerAtom( double lambda ) const
+    {
+      if ( m_table && m_table->coversWavelength( lambda ) )
+        return m_table->xsect( m_tableWeights, lambda );
+      const double xsect_cell = m_kernel.eval<TModel>( lambda );
+      return xsect_cell > 0.0 ? xsect_cell * m_invNAtoms : 0.0;//protect against negative numbers and NaNs propagating from nxslib code.
+    }
+
+    const NXSBkgdTable * table() const { return m_table.get(); }
+
+  private:
+    NXSBkgdKernel m_kernel;
+    double m_invNAtoms;
+    std::shared_ptr<const NXSBkgdTable> m_table;
+    NXSBkgdTable::TemperatureWeights m_tableWeights;
+  };
+
+  //Source of any model. Users visit it once, when setting up a process or a
+  //cross section provider, and then use the NXSBkgdSourceT of the model:
+  using NXSBkgdSource = std::variant<NXSBkgdSourceT<NXSBkgdModel::NXSG4>,
+                                     NXSBkgdSourceT<NXSBkgdModel::NXSG4_Cassels>,
+                                     NXSBkgdSourceT<NXSBkgdModel::NXSG4_Freund>,
+                                     NXSBkgdSourceT<NXSBkgdModel::McStas>>;
+  std::shared_ptr<const NXSBkgdSource> makeNXSBkgdSource( NXSBkgdKernel,
+                                                          unsigned natoms,
+                                                          double temperature,
+                                                          std::shared_ptr<const NXSBkgdTable> table = nullptr );
+
+  //Sources of loaded materials, referred to by their NXSBKGD custom section:
+  SharedObjectRegistry<NXSBkgdSource>& bkgdSourceRegistry();
+
+  //The background as a process of its own, holding a copy of the source (and
+  //so the kernel constants) inline. As for NCrystal's standard processes for
+  //background curves provided via Info objects, scatterings are elastic and
+  //isotropic:
+  template<NXSBkgdModel TModel>
+  class NXSBkgdScatter final : public NC::ProcImpl::ScatterIsotropicMat {
+  public:
+    NXSBkgdScatter( const NXSBkgdSourceT<TModel>& bkgd ) : m_bkgd(bkgd) {}
+    const char * name() const noexcept override { return NCPLUGIN_NAME_CSTR "Bkgd"; }
+    NC::EnergyDomain domain() const noexcept override
+    {
+      return { NC::NeutronEnergy{ 0.0 }, NC::NeutronEnergy{ NC::kInfinity } };
+    }
+    NC::CrossSect crossSectionIsotropic( NC::CachePtr&, NC::NeutronEnergy ekin ) const override
+    {
+      return NC::CrossSect{ m_bkgd.xsectPerAtom( ekin.wavelength().dbl() ) };
+    }
+    NC::ScatterOutcomeIsotropic sampleScatterIsotropic( NC::CachePtr&, NC::RNG& rng, NC::NeutronEnergy ekin ) const override
+    {
+      return { ekin, NC::CosineScatAngle{ rng.generate() * 2.0 - 1.0 } };
+    }
+  private:
+    NXSBkgdSourceT<TModel> m_bkgd;
+  };
+
+}
+
+#endif
@@ -0,0 +1,177 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCNXSBkgdTable.hh"
+#include "NCrystal/internal/utils/NCString.hh"
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <tuple>
+
+namespace NC = NCrystal;
+
+NC::Optional<NCP::NXSBkgdTable::Grid> NCP::NXSBkgdTable::gridFromEnv()
+{
+  const char * ev = std::getenv("NCRYSTAL_NXSLIB_BKGDTABLE");
+  if ( !ev || !ev[0] || std::string(ev) == "0" )
+    return NC::NullOpt;
+  Grid grid;
+  if ( std::string(ev) == "1" )
+    return grid;
+  auto parts = NC::split2( ev, 0, ':' );
+  double tmin, tmax;
+  int nt, nlambda;
+  if ( parts.size() != 4
+       || !NC::safe_str2dbl( parts.at(0), tmin )
+       || !NC::safe_str2dbl( parts.at(1), tmax )
+       || !NC::safe_str2int( parts.at(2), nt )
+       || !NC::safe_str2int( parts.at(3), nlambda )
+       || !(tmin > 0.0) || !(tmax > tmin) || nt < 2 || nlambda < 8 || nt*nlambda > 100000000 )
+    NCRYSTAL_THROW2(BadInput,"Invalid value of NCRYSTAL_NXSLIB_BKGDTABLE (must be 1 or"
+                    " tmin:tmax:nt:nlambda): \""<<ev<<"\"");
+  grid.tmin = tmin;
+  grid.tmax = tmax;
+  grid.nt = static_cast<unsigned>(nt);
+  grid.nlambda = static_cast<unsigned>(nlambda);
+  return grid;
+}
+
+NCP::NXSBkgdTable::NXSBkgdTable( const nxs::NXS_UnitCell& nxs_uc_orig,
+                                 NXSBkgdModel model,
+                                 const Grid& grid )
+  : m_grid(grid),
+    m_logtmin(std::log(grid.tmin)),
+    m_inv_dlogt( ( grid.nt - 1 ) / std::log( grid.tmax / grid.tmin ) ),
+    m_inv_natoms( 1.0 / nxs_uc_orig.nAtoms )
+{
+  nc_assert_always( grid.nt >= 2 && grid.nlambda >= 8 );
+  nc_assert_always( grid.tmin > 0.0 && grid.tmax > grid.tmin );
+  nc_assert_always( grid.lambdamin > 0.0 && grid.lambdamax > grid.lambdamin );
+
+  //Wavelength nodes, with the kinks of nxs_MultiPhonon_COMBINED as segment
+  //boundaries (when inside the range):
+  const double lambda_debye = 30.8106673293723 / std::sqrt( nxs_uc_orig.debyeTemp );
+  std::vector<double> breakpoints{ grid.lambdamin };
+  for ( double bp : { lambda_debye * 1.78789683887, lambda_debye * 3.68096408002 } )
+    if ( bp > grid.lambdamin * 1.001 && bp < grid.lambdamax * 0.999 )
+      breakpoints.push_back( bp );
+  breakpoints.push_back( grid.lambdamax );
+  const double logrange = std::log( grid.lambdamax / grid.lambdamin );
+  m_logbreaks[0] = m_logbreaks[1] = NC::kInfinity;
+  for ( std::size_t iseg = 0; iseg + 1 < breakpoints.size(); ++iseg ) {
+    const double l0 = breakpoints.at(iseg);
+    const double l1 = breakpoints.at(iseg+1);
+    const double seglogrange = std::log( l1 / l0 );
+    const unsigned n = std::max<unsigned>( 2, static_cast<unsigned>( std::lround( grid.nlambda * seglogrange / logrange ) ) );
+    Segment& seg = m_segments[iseg];
+    seg.loglambdamin = std::log( l0 );
+    seg.inv_dloglambda = n / seglogrange;
+    seg.ifirst = static_cast<unsigned>( m_lambdas.size() );
+    seg.n = n;
+    if ( iseg > 0 )
+      m_logbreaks[iseg-1] = seg.loglambdamin;
+    for ( unsigned i = 0; i < n; ++i )
+      m_lambdas.push_back( l0 * std::exp( seglogrange * i / n ) );
+  }
+  for ( std::size_t iseg = breakpoints.size() - 1; iseg < 3; ++iseg )
+    m_segments[iseg] = m_segments[0];//never used
+  m_lambdas.push_back( grid.lambdamax );
+  m_nlambdas = m_lambdas.size();
+  const std::size_t nlambdas = m_nlambdas;
+
+  //Private copy of the unit cell, with its own atom list (which is modified by
+  //nxs_setTemperature):
+  nxs::NXS_UnitCell uc = nxs_uc_orig;
+  uc.hklList = nullptr;
+  uc.hklCumFMd = nullptr;
+  uc.nHKL = 0;
+  std::vector<nxs::NXS_AtomInfo> atoms( nxs_uc_orig.atomInfoList,
+                                        nxs_uc_orig.atomInfoList + nxs_uc_orig.nAtomInfo );
+  uc.atomInfoList = atoms.data();
+
+  m_values.resize( grid.nt * nlambdas );
+  for ( unsigned it = 0; it < grid.nt; ++it ) {
+    const double temperature = ( it + 1 == grid.nt
+                                 ? grid.tmax
+                                 : std::exp( m_logtmin + it / m_inv_dlogt ) );
+    nxs::nxs_setTemperature( &uc, temperature );
+    const NXSBkgdKernel kernel( uc, model );
+    double * row = &m_values[it*nlambdas];
+    visitNXSBkgdModel( model, [this,&kernel,row,nlambdas]( auto m )
+    {
+      for ( std::size_t il = 0; il < nlambdas; ++il )
+        row[il] = kernel.eval<decltype(m)::value>( m_lambdas[il] ) * m_inv_natoms;
+    } );
+  }
+}
+
+NCP::NXSBkgdTable::TemperatureWeights NCP::NXSBkgdTable::temperatureWeights( double temperature ) const
+{
+  nc_assert( coversTemperature( temperature ) );
+  double ft = ( std::log( temperature ) - m_logtmin ) * m_inv_dlogt;
+  const unsigned it = std::min<unsigned>( static_cast<unsigned>( ft ), m_grid.nt - 2 );
+  return { it * m_nlambdas, ft - it };
+}
+
+std::size_t NCP::NXSBkgdTable::memoryUsage() const
+{
+  return ( sizeof(*this)
+           + m_values.capacity() * sizeof(double)
+           + m_lambdas.capacity() * sizeof(double) );
+}
+
+std::shared_ptr<const NCP::NXSBkgdTable> NCP::getSharedBkgdTable( std::uint64_t dataHash,
+                                                                  NXSBkgdModel model,
+                                                                  bool fixpolyatom,
+                                                                  const nxs::NXS_UnitCell& nxs_uc,
+                                                                  const NXSBkgdTable::Grid& grid )
+{
+  using Key = std::tuple<std::uint64_t,int,bool,double,double,unsigned,double,double,unsigned>;
+  static std::mutex s_mtx;
+  static std::map<Key,std::weak_ptr<const NXSBkgdTable>> s_tables;
+  const Key key{ dataHash, static_cast<int>(model), fixpolyatom,
+                 grid.tmin, grid.tmax, grid.nt, grid.lambdamin, grid.lambdamax, grid.nlambda };
+  {
+    NCRYSTAL_LOCK_GUARD(s_mtx);
+    auto it = s_tables.find( key );
+    if ( it != s_tables.end() ) {
+      auto table = it->second.lock();
+      if ( table )
+        return table;
+    }
+  }
+  //Build outside the lock (at worst a table is built twice if requested
+  //concurrently for the first time):
+  auto table = std::make_shared<const NXSBkgdTable>( nxs_uc, model, grid );
+  NCRYSTAL_LOCK_GUARD(s_mtx);
+  auto& entry = s_tables[key];
+  auto existing = entry.lock();
+  if ( existing )
+    return existing;
+  entry = table;
+  //Forget expired entries:
+  for ( auto it = s_tables.begin(); it != s_tables.end(); ) {
+    if ( it->second.expired() )
+      it = s_tables.erase( it );
+    else
+      ++it;
+  }
+  return table;
+}
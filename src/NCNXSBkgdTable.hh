@@ -0,0 +1,133 @@
+#ifndef NCPlugin_NXSBkgdTable_hh
+#define NCPlugin_NXSBkgdTable_hh
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCrystal/NCPluginBoilerplate.hh"
+#include "NCNXSBkgdModel.hh"
+#include <cmath>
+
+namespace NCPluginNamespace {
+
+  //Background cross section (per atom, clamped at 0) of a given structure,
+  //tabulated on a (temperature, wavelength) grid, so that materials at many
+  //different temperatures (e.g. in thermal gradients) can be served from a
+  //single compact table by bilinear interpolation. The temperature grid is
+  //logarithmic, and the wavelength grid is logarithmic within each of the
+  //three ranges separated by the switch-over points of
+  //nxs_MultiPhonon_COMBINED, where the background curve has kinks. The
+  //unclamped values are tabulated (and clamped after interpolation), since the
+  //McStas-like background otherwise has kinks where it crosses 0.
+  //
+  //With the default grid, the interpolation error is below ~1% of the larger
+  //of the cross section itself and 1% of the bound scattering cross section
+  //for the bundled data files.
+  //
+  //Since the temperature of a given material is fixed, its users look up the
+  //temperature interpolation weights once (temperatureWeights), and the
+  //wavelength segment is found directly from log(lambda), so each lookup is
+  //a single log and two linear interpolations.
+
+  class NXSBkgdTable final : private NC::NoCopyMove {
+  public:
+    struct Grid {
+      double tmin = 5.0;
+      double tmax = 1500.0;
+      unsigned nt = 128;
+      double lambdamin = 0.01;
+      double lambdamax = 100.0;
+      unsigned nlambda = 512;
+    };
+
+    //Grid from the environment variable NCRYSTAL_NXSLIB_BKGDTABLE, or NullOpt
+    //if it is not set (in which case tables are not used by
+    //loadNXSCrystal). Set it to "1" for the default grid, or to
+    //"tmin:tmax:nt:nlambda" to control the grid:
+    static NC::Optional<Grid> gridFromEnv();
+
+    //Tabulate, using nxs_setTemperature on a private copy of the unit cell
+    //(which must have all atoms added and nxs_initAverageSigma called):
+    NXSBkgdTable( const nxs::NXS_UnitCell&, NXSBkgdModel, const Grid& );
+
+    const Grid& grid() const { return m_grid; }
+    bool coversTemperature( double temperature ) const
+    {
+      return temperature >= m_grid.tmin && temperature <= m_grid.tmax;
+    }
+    bool coversWavelength( double lambda ) const
+    {
+      return lambda >= m_grid.lambdamin && lambda <= m_grid.lambdamax;
+    }
+
+    //Interpolation weights at a given temperature. Requires
+    //coversTemperature(T):
+    struct TemperatureWeights {
+      std::size_t offset;//of the row below T in the value table
+      double f;//weight of the row above T
+    };
+    TemperatureWeights temperatureWeights( double temperature ) const;
+
+    //Interpolated cross section per atom [barn]. Requires coversWavelength:
+    double xsect( const TemperatureWeights& tw, double lambda ) const
+    {
+      nc_assert( coversWavelength( lambda ) );
+      const double loglambda = std::log( lambda );
+      const Segment& seg = m_segments[ ( loglambda >= m_logbreaks[0] ? 1 : 0 )
+                                       + ( loglambda >= m_logbreaks[1] ? 1 : 0 ) ];
+      double fl = ( loglambda - seg.loglambdamin ) * seg.inv_dloglambda;
+      const unsigned il = std::min<unsigned>( static_cast<unsigned>( fl ), seg.n - 1 );
+      fl -= il;
+      const double * r0 = &m_values[tw.offset + seg.ifirst + il];
+      const double * r1 = r0 + m_nlambdas;
+      const double v0 = r0[0] + fl * ( r0[1] - r0[0] );
+      const double v1 = r1[0] + fl * ( r1[1] - r1[0] );
+      const double v = v0 + tw.f * ( v1 - v0 );
+      return v > 0.0 ? v : 0.0;
+    }
+
+    std::size_t memoryUsage() const;
+
+  private:
+    Grid m_grid;
+    double m_logtmin;
+    double m_inv_dlogt;
+    std::vector<double> m_lambdas;//nodes (piecewise log-uniform)
+    std::size_t m_nlambdas;
+    struct Segment { double loglambdamin; double inv_dloglambda; unsigned ifirst; unsigned n; };
+    //At most three segments, with log(lambda) of the inner boundaries (or
+    //infinity for missing ones):
+    Segment m_segments[3];
+    double m_logbreaks[2];
+    std::vector<double> m_values;//[it*nlambdas+ilambda], per atom
+    double m_inv_natoms;
+  };
+
+  //Tables shared between all users of the same data and background model
+  //(and grid), kept alive only as long as they are in use:
+  std::shared_ptr<const NXSBkgdTable> getSharedBkgdTable( std::uint64_t dataHash,
+                                                          NXSBkgdModel,
+                                                          bool fixpolyatom,
+                                                          const nxs::NXS_UnitCell&,
+                                                          const NXSBkgdTable::Grid& );
+
+}
+
+#endif
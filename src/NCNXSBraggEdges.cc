@@ -0,0 +1,119 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCNXSBraggEdges.hh"
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <vector>
+
+namespace NC = NCrystal;
+
+namespace NCPluginNamespace {
+  namespace {
+    void sweepChunk( nxs::NXS_UnitCell* uc, std::size_t n, const double * lambdas, double * xsects )
+    {
+      //nxslib counts in unsigned int:
+      constexpr std::size_t nmax = std::numeric_limits<unsigned int>::max();
+      while ( n ) {
+        const std::size_t nchunk = std::min( n, nmax );
+        if ( NXS_ERROR_OK != nxs::nxs_CoherentElasticSweep( static_cast<unsigned int>(nchunk),
+                                                             lambdas, uc, xsects ) )
+          NCRYSTAL_THROW(BadInput,"coherentElasticSpectrum: wavelengths must be in ascending order");
+        n -= nchunk;
+        lambdas += nchunk;
+        xsects += nchunk;
+      }
+    }
+
+    //Splits the grid into contiguous chunks swept concurrently by
+    //sweepChunk(n,lambdas,xsects):
+    template<class TSweep>
+    void sweepInChunks( std::size_t nplanes,
+                        std::size_t n,
+                        const double * lambdas,
+                        double * xsects,
+                        unsigned nthreads,
+                        TSweep&& sweepChunk )
+    {
+      if ( nthreads == 0 )
+        nthreads = std::max<unsigned>( 1, std::thread::hardware_concurrency() );
+      //Each chunk sweeps the plane list down to its own shortest wavelength, so
+      //only split when the grid is large compared to the list:
+      constexpr std::size_t min_chunk = 4096;
+      nthreads = static_cast<unsigned>( std::min<std::size_t>( nthreads,
+                                                               std::max<std::size_t>( 1, n / std::max<std::size_t>( min_chunk, nplanes ) ) ) );
+      if ( nthreads <= 1 ) {
+        sweepChunk( n, lambdas, xsects );
+        return;
+      }
+
+      //Check the ordering up front (also across chunk boundaries), so workers
+      //can not fail:
+      for ( std::size_t i = 1; i < n; ++i )
+        if ( !( lambdas[i-1] <= lambdas[i] ) )
+          NCRYSTAL_THROW(BadInput,"coherentElasticSpectrum: wavelengths must be in ascending order");
+
+      //Workers already started are joined on all exits (including failure to
+      //start another thread), since destroying a joinable std::thread would
+      //terminate the process:
+      std::vector<std::thread> workers;
+      struct JoinGuard {
+        std::vector<std::thread>& workers;
+        ~JoinGuard()
+        {
+          for ( auto& w : workers )
+            if ( w.joinable() )
+              w.join();
+        }
+      } joinGuard{workers};
+      workers.reserve( nthreads - 1 );
+      const std::size_t nchunk = ( n + nthreads - 1 ) / nthreads;
+      for ( std::size_t ifirst = nchunk; ifirst < n; ifirst += nchunk ) {
+        const std::size_t nthis = std::min( nchunk, n - ifirst );
+        workers.emplace_back( [&sweepChunk,nthis,lambdas,xsects,ifirst]()
+                              { sweepChunk( nthis, lambdas + ifirst, xsects + ifirst ); } );
+      }
+      sweepChunk( std::min( nchunk, n ), lambdas, xsects );
+    }
+  }
+}
+
+void NCP::coherentElasticSpectrum( const nxs::NXS_UnitCell& nxs_uc,
+                                   std::size_t n,
+                                   const double * lambdas,
+                                   double * xsects,
+                                   unsigned nthreads )
+{
+  //The nxslib functions only read the unit cell, but take non-const pointers:
+  nxs::NXS_UnitCell* ucpar = const_cast<nxs::NXS_UnitCell*>(&nxs_uc);
+  sweepInChunks( nxs_uc.nHKL, n, lambdas, xsects, nthreads,
+                 [ucpar]( std::size_t nn, const double * l, double * x ) { sweepChunk( ucpar, nn, l, x ); } );
+}
+
+void NCP::coherentElasticSpectrum( const NXSCompactHKL& hkl,
+                                   std::size_t n,
+                                   const double * lambdas,
+                                   double * xsects,
+                                   unsigned nthreads )
+{
+  sweepInChunks( hkl.size(), n, lambdas, xsects, nthreads,
+                 [&hkl]( std::size_t nn, const double * l, double * x ) { hkl.coherentElasticSweep( nn, l, x ); } );
+}
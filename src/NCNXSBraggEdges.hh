@@ -0,0 +1,56 @@
+#ifndef NCPlugin_NXSBraggEdges_hh
+#define NCPlugin_NXSBraggEdges_hh
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCrystal/NCPluginBoilerplate.hh"
+#include "NCNXSLib.hh"
+#include "NCNXSCompactHKL.hh"
+
+namespace NCPluginNamespace {
+
+  //Coherent elastic (Bragg edge) cross sections [barn per unit cell] of an
+  //nxslib unit cell with initialised hkl list, at each of n wavelengths in
+  //ascending order (throws BadInput otherwise). Results are identical to those
+  //of nxs_CoherentElastic at each point, but are evaluated with
+  //nxs_CoherentElasticSweep. For nthreads>1 the grid is split into that many
+  //contiguous chunks which are swept concurrently (nthreads=0 means one per
+  //hardware thread). Splitting is skipped for small grids.
+  //
+  //These are internal to the plugin (which is loaded as a module without
+  //installed headers), and only used by nxslib_bench and the plugin tests.
+  void coherentElasticSpectrum( const nxs::NXS_UnitCell&,
+                                std::size_t n,
+                                const double * lambdas,
+                                double * xsects,
+                                unsigned nthreads = 1 );
+
+  //Same, but evaluated with NXSCompactHKL::coherentElasticSweep (see the
+  //accuracy contract there), which reads much less memory per plane:
+  void coherentElasticSpectrum( const NXSCompactHKL&,
+                                std::size_t n,
+                                const double * lambdas,
+                                double * xsects,
+                                unsigned nthreads = 1 );
+
+}
+
+#endif
@@ -0,0 +1,102 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCNXSCompactHKL.hh"
+#include <algorithm>
+#include <limits>
+
+namespace NC = NCrystal;
+
+NCP::NXSCompactHKL::NXSCompactHKL( const nxs::NXS_UnitCell& uc )
+  : m_xsfact( 1E-2 / ( 2.0 * uc.volume ) )
+{
+  //nxslib sorts its list with a tolerance, so near-identical d-spacings might
+  //be out of order. Sort the rounded values, so the edges can be found by
+  //binary search:
+  const std::size_t n = uc.nHKL;
+  std::vector<std::uint32_t> order( n );
+  for ( std::size_t i = 0; i < n; ++i )
+    order[i] = static_cast<std::uint32_t>( i );
+  std::stable_sort( order.begin(), order.end(), [&uc]( std::uint32_t a, std::uint32_t b )
+                    { return static_cast<float>( uc.hklList[a].dhkl ) > static_cast<float>( uc.hklList[b].dhkl ); } );
+
+  m_h.reserve( n );
+  m_k.reserve( n );
+  m_l.reserve( n );
+  m_d.reserve( n );
+  m_fsqmult.reserve( n );
+  m_cumfmd.reserve( n + 1 );
+  m_cumfmd.push_back( 0.0 );
+  auto toInt16 = []( int v )
+  {
+    if ( v < std::numeric_limits<std::int16_t>::min() || v > std::numeric_limits<std::int16_t>::max() )
+      NCRYSTAL_THROW(CalcError,"NXSCompactHKL: Miller index out of range");
+    return static_cast<std::int16_t>( v );
+  };
+  for ( auto i : order ) {
+    const nxs::NXS_HKL& e = uc.hklList[i];
+    m_h.push_back( toInt16( e.h ) );
+    m_k.push_back( toInt16( e.k ) );
+    m_l.push_back( toInt16( e.l ) );
+    m_d.push_back( static_cast<float>( e.dhkl ) );
+    m_fsqmult.push_back( static_cast<float>( e.FSquare * e.multiplicity ) );
+    m_cumfmd.push_back( m_cumfmd.back() + e.FSquare * e.multiplicity * e.dhkl );
+  }
+}
+
+std::size_t NCP::NXSCompactHKL::nContributing( double lambda ) const
+{
+  //Same criterion as nxs_CoherentElastic (d is decreasing, so the predicate
+  //is true for a prefix):
+  auto it = std::partition_point( m_d.begin(), m_d.end(),
+                                  [lambda]( float d ) { return lambda - 2.0 * d < 1E-6; } );
+  return static_cast<std::size_t>( it - m_d.begin() );
+}
+
+double NCP::NXSCompactHKL::coherentElastic( double lambda ) const
+{
+  return m_cumfmd[ nContributing( lambda ) ] * m_xsfact * lambda * lambda;
+}
+
+void NCP::NXSCompactHKL::coherentElasticSweep( std::size_t n, const double * lambdas, double * xsects ) const
+{
+  for ( std::size_t i = 1; i < n; ++i )
+    if ( !( lambdas[i-1] <= lambdas[i] ) )
+      NCRYSTAL_THROW(BadInput,"coherentElasticSweep: wavelengths must be in ascending order");
+  //Decreasing wavelengths, so planes are only ever added:
+  const std::size_t nplanes = m_d.size();
+  const float * d = m_d.data();
+  std::size_t ihkl = 0;
+  for ( std::size_t i = n; i-- > 0; ) {
+    const double lambda = lambdas[i];
+    while ( ihkl < nplanes && lambda - 2.0 * d[ihkl] < 1E-6 )
+      ++ihkl;
+    xsects[i] = m_cumfmd[ihkl] * m_xsfact * lambda * lambda;
+  }
+}
+
+std::size_t NCP::NXSCompactHKL::memoryUsage() const
+{
+  return sizeof(*this)
+    + m_h.capacity() * sizeof(std::int16_t) * 3
+    + m_d.capacity() * sizeof(float)
+    + m_fsqmult.capacity() * sizeof(float)
+    + m_cumfmd.capacity() * sizeof(double);
+}
@@ -0,0 +1,337 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCNXSFSquare.hh"
+#include "NCrystal/internal/utils/NCString.hh"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <new>
+
+namespace NC = NCrystal;
+
+namespace NCPluginNamespace {
+  namespace {
+
+    using cplx = std::complex<double>;
+
+    //Half-width of the Gaussian spreading kernel in grid points (giving
+    //~1e-12 precision at an oversampling of 2):
+    constexpr unsigned kSpread = 12;
+
+    //Smallest size >= nmin with no prime factors other than 2, 3 and 5:
+    std::size_t fftSize( std::size_t nmin )
+    {
+      for ( std::size_t n = std::max<std::size_t>( nmin, 1 ); ; ++n ) {
+        std::size_t m = n;
+        for ( std::size_t p : { 2, 3, 5 } )
+          while ( m % p == 0 )
+            m /= p;
+        if ( m == 1 )
+          return n;
+      }
+    }
+
+    //Forward DFT, X_k = sum_j x_j exp(-2*pi*i*j*k/n), of sizes returned by
+    //fftSize (recursive mixed radix decimation in time):
+    class FFT1D {
+    public:
+      explicit FFT1D( std::size_t n )
+        : m_n( n ), m_tw( n )
+      {
+        for ( std::size_t k = 0; k < n; ++k )
+          m_tw[k] = std::polar( 1.0, -2.0 * NC::kPi * static_cast<double>( k ) / static_cast<double>( n ) );
+        for ( std::size_t p : { 5, 3, 2 } )
+          while ( n % p == 0 ) {
+            m_factors.push_back( p );
+            n /= p;
+          }
+        nc_assert_always( n == 1 );
+        //Roots of unity of each radix, w_p^(q*r) at [p*p+q*p+r]:
+        m_wp.resize( 5 * 5 + 5 * 5 );
+        for ( std::size_t p : { 2, 3, 5 } )
+          for ( std::size_t q = 0; q < p; ++q )
+            for ( std::size_t r = 0; r < p; ++r )
+              m_wp[p*p+q*p+r] = m_tw[ ( q * r * ( m_n / p ) ) % m_n ];
+      }
+
+      //Input strided, output contiguous:
+      void transform( const cplx * in, std::size_t stride, cplx * out ) const
+      {
+        recurse( in, stride, out, m_n, 0, 1 );
+      }
+
+    private:
+      std::size_t m_n;
+      std::vector<cplx> m_tw;
+      std::vector<cplx> m_wp;
+      std::vector<std::size_t> m_factors;
+
+      void recurse( const cplx * in, std::size_t stride, cplx * out,
+                    std::size_t n, std::size_t ifac, std::size_t twstride ) const
+      {
+        if ( n == 1 ) {
+          out[0] = in[0];
+          return;
+        }
+        const std::size_t p = m_factors[ifac];
+        const std::size_t m = n / p;
+        for ( std::size_t q = 0; q < p; ++q )
+          recurse( in + q * stride, stride * p, out + q * m, m, ifac + 1, twstride * p );
+        //Combine the p sub-transforms: X[k+r*m] = sum_q w_n^(q*k) w_p^(q*r) Y_q[k],
+        //where w_n^j = m_tw[j*twstride]:
+        const cplx * wp = &m_wp[p*p];
+        cplx t[5], u[5];
+        for ( std::size_t k = 0; k < m; ++k ) {
+          t[0] = out[k];
+          for ( std::size_t q = 1; q < p; ++q )
+            t[q] = out[q * m + k] * m_tw[q * k * twstride];
+          for ( std::size_t r = 0; r < p; ++r ) {
+            cplx s = t[0];
+            for ( std::size_t q = 1; q < p; ++q )
+              s += t[q] * wp[q*p+r];
+            u[r] = s;
+          }
+          for ( std::size_t r = 0; r < p; ++r )
+            out[r * m + k] = u[r];
+        }
+      }
+    };
+
+    //Atoms with common b_coherent and B_iso:
+    struct Species {
+      double b_coherent;
+      double B_iso;
+      std::vector<std::array<double,3>> positions;
+    };
+
+    std::vector<Species> groupSpecies( const nxs::NXS_UnitCell& uc )
+    {
+      std::vector<Species> species;
+      for ( unsigned i = 0; i < uc.nAtomInfo; ++i ) {
+        const nxs::NXS_AtomInfo& ai = uc.atomInfoList[i];
+        auto it = std::find_if( species.begin(), species.end(), [&ai]( const Species& s )
+                                { return s.b_coherent == ai.b_coherent && s.B_iso == ai.B_iso; } );
+        if ( it == species.end() ) {
+          species.push_back( Species{ ai.b_coherent, ai.B_iso, {} } );
+          it = std::prev( species.end() );
+        }
+        for ( unsigned j = 0; j < ai.nAtoms; ++j ) {
+          //Same special treatment of atoms at the origin as in nxs_calcFSquare:
+          if ( std::fabs( ai.x[j] + ai.y[j] + ai.z[j] ) < 1E-6 )
+            it->positions.push_back( { 0.0, 0.0, 0.0 } );
+          else
+            it->positions.push_back( { ai.x[j], ai.y[j], ai.z[j] } );
+        }
+      }
+      return species;
+    }
+
+    unsigned maxAbsIndex( const nxs::NXS_HKL * hkl, unsigned nHKL )
+    {
+      int n = 0;
+      for ( unsigned i = 0; i < nHKL; ++i )
+        n = std::max( { n, std::abs( hkl[i].h ), std::abs( hkl[i].k ), std::abs( hkl[i].l ) } );
+      return static_cast<unsigned>( n );
+    }
+
+    std::size_t gridSize( unsigned maxidx, double oversampling )
+    {
+      const std::size_t nmodes = 2 * maxidx + 1;
+      return fftSize( std::max<std::size_t>( static_cast<std::size_t>( std::ceil( oversampling * nmodes ) ),
+                                             2 * kSpread ) );
+    }
+
+  }
+}
+
+NCP::NXSFSquareOptions NCP::NXSFSquareOptions::fromEnv()
+{
+  NXSFSquareOptions opt;
+  const char * ev = std::getenv("NCRYSTAL_NXSLIB_FSQUARE");
+  if ( !ev || !ev[0] )
+    return opt;
+  const std::string s( ev );
+  if ( s == "auto" )
+    return opt;
+  if ( s == "direct" ) {
+    opt.engine = Engine::Direct;
+    return opt;
+  }
+  auto parts = NC::split2( s, 0, ':' );
+  double oversampling = opt.oversampling;
+  if ( parts.at(0) != "fft" || parts.size() > 2
+       || ( parts.size() == 2 && !NC::safe_str2dbl( parts.at(1), oversampling ) )
+       || !( oversampling >= 1.5 ) || !( oversampling <= 16.0 ) )
+    NCRYSTAL_THROW2(BadInput,"Invalid value of NCRYSTAL_NXSLIB_FSQUARE (must be auto, direct, fft"
+                    " or fft:<oversampling> with oversampling in [1.5,16]): \""<<ev<<"\"");
+  opt.engine = Engine::FFT;
+  opt.oversampling = oversampling;
+  return opt;
+}
+
+void NCP::calcFSquareDirect( const nxs::NXS_UnitCell& uc, nxs::NXS_HKL * hkl, unsigned nHKL )
+{
+  //nxs_calcFSquare only reads its arguments:
+  auto ucptr = const_cast<nxs::NXS_UnitCell*>( &uc );
+  for ( unsigned i = 0; i < nHKL; ++i )
+    hkl[i].FSquare = nxs::nxs_calcFSquare( &hkl[i], ucptr );
+}
+
+bool NCP::preferFSquareFFT( const nxs::NXS_UnitCell& uc, const nxs::NXS_HKL * hkl, unsigned nHKL,
+                            double oversampling )
+{
+  if ( !nHKL )
+    return false;
+  const std::size_t nspecies = groupSpecies( uc ).size();
+  const unsigned maxidx = maxAbsIndex( hkl, nHKL );
+  const double nmodes = 2.0 * maxidx + 1.0;
+  const double mr = static_cast<double>( gridSize( maxidx, oversampling ) );
+  //Relative costs, in units of one term of the direct sum:
+  const double cost_direct = double( nHKL ) * uc.nAtoms;
+  const double cost_spread = 0.02 * uc.nAtoms * std::pow( 2.0 * kSpread, 3 );
+  const double cost_fft = ( 0.15 * std::log2( mr ) * mr * ( mr * mr + mr * nmodes + nmodes * nmodes )
+                            + 0.1 * nHKL ) * nspecies;
+  return cost_spread + cost_fft < cost_direct;
+}
+
+void NCP::calcFSquareFFT( const nxs::NXS_UnitCell& uc, nxs::NXS_HKL * hkl, unsigned nHKL,
+                          double oversampling )
+{
+  if ( !nHKL )
+    return;
+  nc_assert_always( oversampling >= 1.5 );
+  const unsigned maxidx = maxAbsIndex( hkl, nHKL );
+  const std::size_t nm = 2 * maxidx + 1;//needed modes -maxidx..maxidx
+  const std::size_t mr = gridSize( maxidx, oversampling );
+  const double sigma = double( mr ) / double( nm );//actual oversampling
+  const double tau = NC::kPi * kSpread / ( double( nm * nm ) * sigma * ( sigma - 0.5 ) );
+  const double dx = 2.0 * NC::kPi / double( mr );
+  const double kern_fact = -dx * dx / ( 4.0 * tau );
+
+  //For mode f=q-maxidx, the FFT output index and the factor dividing out the
+  //kernel (and normalising the transform) in one dimension:
+  std::vector<std::size_t> fftidx( nm );
+  std::vector<double> deconv( nm );
+  for ( std::size_t q = 0; q < nm; ++q ) {
+    const long f = static_cast<long>( q ) - static_cast<long>( maxidx );
+    fftidx[q] = static_cast<std::size_t>( ( f + static_cast<long>( mr ) ) % static_cast<long>( mr ) );
+    deconv[q] = std::sqrt( NC::kPi / tau ) * std::exp( tau * double( f * f ) ) / double( mr );
+  }
+
+  const FFT1D fft( mr );
+  std::vector<cplx> F( nHKL, cplx( 0.0 ) );
+  std::vector<double> grid;
+  std::vector<cplx> a, b, c;
+  std::vector<cplx> line_in( mr ), line_out( mr );
+
+  for ( const auto& sp : groupSpecies( uc ) ) {
+    //Spread the atoms onto the periodic grid:
+    grid.assign( mr * mr * mr, 0.0 );
+    std::array<std::array<double,2*kSpread>,3> w;
+    std::array<std::array<std::size_t,2*kSpread>,3> idx;
+    for ( const auto& pos : sp.positions ) {
+      for ( unsigned d = 0; d < 3; ++d ) {
+        const double u = pos[d] * double( mr );
+        const long m0 = static_cast<long>( std::floor( u ) ) - static_cast<long>( kSpread ) + 1;
+        for ( unsigned j = 0; j < 2 * kSpread; ++j ) {
+          const long m = m0 + static_cast<long>( j );
+          const double delta = double( m ) - u;
+          w[d][j] = std::exp( kern_fact * delta * delta );
+          const long mm = m % static_cast<long>( mr );
+          idx[d][j] = static_cast<std::size_t>( mm < 0 ? mm + static_cast<long>( mr ) : mm );
+        }
+      }
+      for ( unsigned ix = 0; ix < 2 * kSpread; ++ix ) {
+        for ( unsigned iy = 0; iy < 2 * kSpread; ++iy ) {
+          const double wxy = w[0][ix] * w[1][iy];
+          double * row = &grid[ ( idx[0][ix] * mr + idx[1][iy] ) * mr ];
+          for ( unsigned iz = 0; iz < 2 * kSpread; ++iz )
+            row[ idx[2][iz] ] += wxy * w[2][iz];
+        }
+      }
+    }
+
+    //Transform one dimension at a time, keeping only the needed modes:
+    //The grid is real, so two lines are transformed at once as the real and
+    //imaginary parts of one complex line, and separated afterwards using
+    //X[-k]=conj(X[k]) for the transform X of a real line:
+    a.resize( mr * mr * nm );
+    for ( std::size_t ixy = 0; ixy < mr * mr; ixy += 2 ) {
+      const bool pair = ixy + 1 < mr * mr;
+      for ( std::size_t iz = 0; iz < mr; ++iz )
+        line_in[iz] = cplx( grid[ ixy * mr + iz ], pair ? grid[ ( ixy + 1 ) * mr + iz ] : 0.0 );
+      fft.transform( line_in.data(), 1, line_out.data() );
+      for ( std::size_t q = 0; q < nm; ++q ) {
+        const cplx z = line_out[ fftidx[q] ];
+        const cplx zc = std::conj( line_out[ fftidx[nm-1-q] ] );
+        a[ ixy * nm + q ] = 0.5 * ( z + zc );
+        if ( pair )
+          a[ ( ixy + 1 ) * nm + q ] = cplx( 0.0, -0.5 ) * ( z - zc );
+      }
+    }
+    b.resize( mr * nm * nm );
+    for ( std::size_t ix = 0; ix < mr; ++ix ) {
+      for ( std::size_t qz = 0; qz < nm; ++qz ) {
+        fft.transform( &a[ ix * mr * nm + qz ], nm, line_out.data() );
+        for ( std::size_t qy = 0; qy < nm; ++qy )
+          b[ ( ix * nm + qy ) * nm + qz ] = line_out[ fftidx[qy] ];
+      }
+    }
+    c.resize( nm * nm * nm );
+    for ( std::size_t qyz = 0; qyz < nm * nm; ++qyz ) {
+      fft.transform( &b[ qyz ], nm * nm, line_out.data() );
+      for ( std::size_t qx = 0; qx < nm; ++qx )
+        c[ qx * nm * nm + qyz ] = line_out[ fftidx[qx] ];
+    }
+
+    //The transform has exp(-i*...), so the geometric sum of exp(+2*pi*i*(hx+ky+lz))
+    //over the atoms is found at mode -h,-k,-l:
+    for ( unsigned i = 0; i < nHKL; ++i ) {
+      const std::size_t qx = maxidx - hkl[i].h;
+      const std::size_t qy = maxidx - hkl[i].k;
+      const std::size_t qz = maxidx - hkl[i].l;
+      const double dhkl = hkl[i].dhkl;
+      const double fact = std::exp( -sp.B_iso / 4.0 / dhkl / dhkl ) * sp.b_coherent
+        * deconv[qx] * deconv[qy] * deconv[qz];
+      F[i] += fact * c[ ( qx * nm + qy ) * nm + qz ];
+    }
+  }
+
+  for ( unsigned i = 0; i < nHKL; ++i )
+    hkl[i].FSquare = std::norm( F[i] );
+}
+
+void NCP::nxsCalcFSquareList( nxs::NXS_HKL * hkl, unsigned nHKL, nxs::NXS_UnitCell * uc, void * options )
+{
+  const auto& opt = *static_cast<const NXSFSquareOptions*>( options );
+  using Engine = NXSFSquareOptions::Engine;
+  if ( opt.engine == Engine::FFT
+       || ( opt.engine == Engine::Auto && preferFSquareFFT( *uc, hkl, nHKL, opt.oversampling ) ) ) {
+    try {
+      calcFSquareFFT( *uc, hkl, nHKL, opt.oversampling );
+      return;
+    } catch ( std::bad_alloc& ) {
+    }
+  }
+  calcFSquareDirect( *uc, hkl, nHKL );
+}
@@ -0,0 +1,72 @@
+#ifndef NCPlugin_NXSFSquare_hh
+#define NCPlugin_NXSFSquare_hh
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCrystal/NCPluginBoilerplate.hh"
+#include "NCNXSLib.hh"
+
+namespace NCPluginNamespace {
+
+  //Evaluation of the structure factors |F|^2 (in the units of
+  //nxs_calcFSquare) of all reflections of an hkl list at once.
+  //
+  //The direct method sums over all atoms for each reflection, which costs
+  //O(nHKL*nAtoms) sines and cosines, and dominates the initialisation of
+  //unit cells with many atoms. The FFT method instead groups the atoms into
+  //species of equal b_coherent and B_iso (whose Debye-Waller factors are then
+  //common), and evaluates the geometric sum of each species for all hkl indices
+  //with |h|,|k|,|l|<=maxhkl in one go with a type-1 non-uniform FFT: the atoms
+  //are spread onto an oversampled real-space grid with a Gaussian kernel, the
+  //grid is Fourier transformed, and the kernel is divided out again (following
+  //Greengard and Lee, SIAM Review 46 (2004) 443). The oversampling factor
+  //(grid points per dimension relative to the 2*maxhkl+1 needed) controls the
+  //accuracy: with the default of 2 the relative deviations of |F|^2 from the
+  //direct method are below ~1e-9 for the strong reflections, and those of F
+  //are below ~1e-12 of the unit cell sum of |b_coherent|. At 1.5 it is ~1.5x
+  //faster but deviations are ~1e-7, at 3 ~3x slower with deviations ~1e-12.
+
+  struct NXSFSquareOptions {
+    enum class Engine { Auto, Direct, FFT };
+    Engine engine = Engine::Auto;
+    double oversampling = 2.0;
+
+    //From the environment variable NCRYSTAL_NXSLIB_FSQUARE, which can be
+    //"auto" (default), "direct", "fft" or "fft:<oversampling>":
+    static NXSFSquareOptions fromEnv();
+  };
+
+  void calcFSquareDirect( const nxs::NXS_UnitCell&, nxs::NXS_HKL *, unsigned nHKL );
+  void calcFSquareFFT( const nxs::NXS_UnitCell&, nxs::NXS_HKL *, unsigned nHKL,
+                       double oversampling = 2.0 );
+
+  //Whether the FFT method is expected to be faster (crude cost model):
+  bool preferFSquareFFT( const nxs::NXS_UnitCell&, const nxs::NXS_HKL *, unsigned nHKL,
+                         double oversampling = 2.0 );
+
+  //Callback for NXS_UnitCell::calcFSquareList, with calcFSquareListData
+  //pointing to a NXSFSquareOptions object. Falls back to the direct method if
+  //the FFT grid can not be allocated:
+  void nxsCalcFSquareList( nxs::NXS_HKL *, unsigned nHKL, nxs::NXS_UnitCell *, void * options );
+
+}
+
+#endif
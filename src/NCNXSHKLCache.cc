@@ -0,0 +1,278 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCNXSHKLCache.hh"
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#  define NCPLUGIN_NXSHKLCACHE_POSIX
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace NC = NCrystal;
+
+namespace NCPluginNamespace {
+  namespace {
+
+    //On-disk layout (native endianness, since the files are only ever shared
+    //between processes on the same node):
+    struct HKLCacheFileHeader {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t recordSize;
+      std::uint64_t dataHash;
+      double temperature;
+      std::uint64_t maxhkl;
+      double dspacingLow;
+      double dspacingHigh;
+      double fsquareCut;
+      std::uint32_t fsquareEngine;
+      std::uint32_t unused;
+      double fsquareOversampling;
+      std::uint64_t nRecords;
+      std::uint64_t nEquivHKL;
+    };
+
+    //Followed by nRecords records and then the nEquivHKL equivalent hkl
+    //points of all records (nEquivHKL of each record, in order):
+    struct HKLCacheRecord {
+      std::int32_t h, k, l;
+      std::int32_t multiplicity;
+      double dspacing;
+      double fsquared;
+      std::int32_t nEquivHKL;//0 if the entry has no explicit values
+      std::int32_t unused;
+    };
+
+    struct HKLCacheEquivHKL {
+      std::int32_t h, k, l;
+    };
+
+    constexpr char hklCacheMagic[8] = { 'N','X','S','H','K','L','C','\0' };
+    constexpr std::uint32_t hklCacheVersion = 4;
+
+    std::uint64_t fnv1a( std::uint64_t h, const void* data, std::size_t n )
+    {
+      auto p = static_cast<const unsigned char*>(data);
+      for ( std::size_t i = 0; i < n; ++i ) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+      }
+      return h;
+    }
+
+    std::uint64_t hashKey( const HKLCacheKey& key )
+    {
+      std::uint64_t h = key.dataHash;
+      std::uint64_t maxhkl = key.maxhkl;
+      h = fnv1a( h, &key.temperature, sizeof(key.temperature) );
+      h = fnv1a( h, &maxhkl, sizeof(maxhkl) );
+      h = fnv1a( h, &key.dspacingRange.first, sizeof(double) );
+      h = fnv1a( h, &key.dspacingRange.second, sizeof(double) );
+      h = fnv1a( h, &key.fsquareCut, sizeof(double) );
+      std::uint32_t engine = static_cast<std::uint32_t>( key.fsquareOptions.engine );
+      h = fnv1a( h, &engine, sizeof(engine) );
+      h = fnv1a( h, &key.fsquareOptions.oversampling, sizeof(double) );
+      return h;
+    }
+
+    std::string cacheFileName( const std::string& cachedir, const HKLCacheKey& key )
+    {
+      std::ostringstream ss;
+      ss << cachedir << "/nxslib_hkl_" << std::hex << hashKey(key) << ".bin";
+      return ss.str();
+    }
+
+    bool headerMatches( const HKLCacheFileHeader& hdr, const HKLCacheKey& key )
+    {
+      return ( std::memcmp( hdr.magic, hklCacheMagic, sizeof(hklCacheMagic) ) == 0
+               && hdr.version == hklCacheVersion
+               && hdr.recordSize == sizeof(HKLCacheRecord)
+               && hdr.dataHash == key.dataHash
+               && hdr.temperature == key.temperature
+               && hdr.maxhkl == key.maxhkl
+               && hdr.dspacingLow == key.dspacingRange.first
+               && hdr.dspacingHigh == key.dspacingRange.second
+               && hdr.fsquareCut == key.fsquareCut
+               && hdr.fsquareEngine == static_cast<std::uint32_t>( key.fsquareOptions.engine )
+               && hdr.fsquareOversampling == key.fsquareOptions.oversampling );
+    }
+  }
+}
+
+std::string NCP::hklCacheDir()
+{
+#ifdef NCPLUGIN_NXSHKLCACHE_POSIX
+  const char * ev = std::getenv("NCRYSTAL_NXSLIB_CACHEDIR");
+  return ev ? std::string(ev) : std::string();
+#else
+  return std::string();
+#endif
+}
+
+std::uint64_t NCP::hashTextData( const NC::TextData& textData )
+{
+  std::uint64_t h = 14695981039346656037ull;
+  for ( const std::string& line : textData ) {
+    h = fnv1a( h, line.data(), line.size() );
+    h = fnv1a( h, "\n", 1 );
+  }
+  return h;
+}
+
+NC::Optional<NC::HKLList> NCP::hklCacheLoad( const std::string& cachedir, const HKLCacheKey& key )
+{
+#ifdef NCPLUGIN_NXSHKLCACHE_POSIX
+  const std::string fn = cacheFileName( cachedir, key );
+  std::FILE * fh = std::fopen( fn.c_str(), "rb" );
+  if ( !fh )
+    return NC::NullOpt;
+  //The file is small compared to the work of recomputing it, so it is simply
+  //read into memory in one go and decoded into a new hkl list:
+  std::vector<char> buf;
+  char chunk[65536];
+  std::size_t n;
+  while ( ( n = std::fread( chunk, 1, sizeof(chunk), fh ) ) > 0 )
+    buf.insert( buf.end(), chunk, chunk + n );
+  const bool readok = !std::ferror(fh);
+  std::fclose(fh);
+  if ( !readok || buf.size() < sizeof(HKLCacheFileHeader) )
+    return NC::NullOpt;
+
+  HKLCacheFileHeader hdr;
+  std::memcpy( &hdr, buf.data(), sizeof(hdr) );
+  if ( !headerMatches( hdr, key )
+       || buf.size() != ( sizeof(hdr) + hdr.nRecords * sizeof(HKLCacheRecord)
+                          + hdr.nEquivHKL * sizeof(HKLCacheEquivHKL) ) )
+    return NC::NullOpt;
+
+  const char * recs = buf.data() + sizeof(hdr);
+  const char * eqv = recs + hdr.nRecords * sizeof(HKLCacheRecord);
+  std::uint64_t nEquivLeft = hdr.nEquivHKL;
+  NC::HKLList hklList;
+  hklList.reserve_hint( hdr.nRecords );
+  for ( std::uint64_t i = 0; i < hdr.nRecords; ++i ) {
+    HKLCacheRecord rec;
+    std::memcpy( &rec, recs + i * sizeof(rec), sizeof(rec) );
+    NC::HKLInfo hi;
+    hi.hkl.h = rec.h;
+    hi.hkl.k = rec.k;
+    hi.hkl.l = rec.l;
+    hi.multiplicity = rec.multiplicity;
+    hi.dspacing = rec.dspacing;
+    hi.fsquared = rec.fsquared;
+    if ( rec.nEquivHKL < 0 || static_cast<std::uint64_t>(rec.nEquivHKL) > nEquivLeft )
+      return NC::NullOpt;
+    if ( rec.nEquivHKL > 0 ) {
+      hi.explicitValues = std::make_unique<NC::HKLInfo::ExplicitVals>();
+      hi.explicitValues->list.reserve( rec.nEquivHKL );
+      for ( std::int32_t j = 0; j < rec.nEquivHKL; ++j, eqv += sizeof(HKLCacheEquivHKL) ) {
+        HKLCacheEquivHKL e;
+        std::memcpy( &e, eqv, sizeof(e) );
+        hi.explicitValues->list.push_back( NC::HKL{ e.h, e.k, e.l } );
+      }
+      nEquivLeft -= rec.nEquivHKL;
+    }
+    hklList.push_back( std::move(hi) );
+  }
+  if ( nEquivLeft != 0 )
+    return NC::NullOpt;
+  return hklList;
+#else
+  (void)cachedir;
+  (void)key;
+  return NC::NullOpt;
+#endif
+}
+
+void NCP::hklCacheStore( const std::string& cachedir, const HKLCacheKey& key, const NC::HKLList& hklList )
+{
+#ifdef NCPLUGIN_NXSHKLCACHE_POSIX
+  const std::string fn = cacheFileName( cachedir, key );
+  //Write to a private file which is then atomically renamed into place, so
+  //readers never see partially written files (and concurrent writers of the
+  //same key simply replace each other's identical content). The private name
+  //comes from mkstemp, since writers might be threads of the same process:
+  std::string fntmp = fn + ".tmp.XXXXXX";
+  int fd = ::mkstemp( &fntmp[0] );
+  if ( fd < 0 )
+    return;
+  ::fchmod( fd, 0644 );//mkstemp uses 0600, but the file is shared
+
+  HKLCacheFileHeader hdr;
+  std::memset( &hdr, 0, sizeof(hdr) );
+  std::memcpy( hdr.magic, hklCacheMagic, sizeof(hklCacheMagic) );
+  hdr.version = hklCacheVersion;
+  hdr.recordSize = sizeof(HKLCacheRecord);
+  hdr.dataHash = key.dataHash;
+  hdr.temperature = key.temperature;
+  hdr.maxhkl = key.maxhkl;
+  hdr.dspacingLow = key.dspacingRange.first;
+  hdr.dspacingHigh = key.dspacingRange.second;
+  hdr.fsquareCut = key.fsquareCut;
+  hdr.fsquareEngine = static_cast<std::uint32_t>( key.fsquareOptions.engine );
+  hdr.fsquareOversampling = key.fsquareOptions.oversampling;
+  hdr.nRecords = hklList.size();
+  for ( auto& e : hklList )
+    hdr.nEquivHKL += ( e.explicitValues ? e.explicitValues->list.size() : 0 );
+
+  std::FILE * fh = ::fdopen( fd, "wb" );
+  if ( !fh ) {
+    ::close(fd);
+    std::remove( fntmp.c_str() );
+    return;
+  }
+  bool ok = ( std::fwrite( &hdr, sizeof(hdr), 1, fh ) == 1 );
+  for ( auto it = hklList.begin(); ok && it != hklList.end(); ++it ) {
+    HKLCacheRecord rec;
+    rec.h = it->hkl.h;
+    rec.k = it->hkl.k;
+    rec.l = it->hkl.l;
+    rec.multiplicity = it->multiplicity;
+    rec.dspacing = it->dspacing;
+    rec.fsquared = it->fsquared;
+    rec.nEquivHKL = static_cast<std::int32_t>( it->explicitValues ? it->explicitValues->list.size() : 0 );
+    rec.unused = 0;
+    ok = ( std::fwrite( &rec, sizeof(rec), 1, fh ) == 1 );
+  }
+  for ( auto it = hklList.begin(); ok && it != hklList.end(); ++it ) {
+    if ( !it->explicitValues )
+      continue;
+    for ( auto& e : it->explicitValues->list ) {
+      HKLCacheEquivHKL rec;
+      rec.h = e.h;
+      rec.k = e.k;
+      rec.l = e.l;
+      ok = ok && ( std::fwrite( &rec, sizeof(rec), 1, fh ) == 1 );
+    }
+  }
+  ok = ( std::fclose(fh) == 0 ) && ok;
+  if ( !ok || std::rename( fntmp.c_str(), fn.c_str() ) != 0 )
+    std::remove( fntmp.c_str() );
+#else
+  (void)cachedir;
+  (void)key;
+  (void)hklList;
+#endif
+}
@@ -0,0 +1,65 @@
+#ifndef NCPlugin_NXSHKLCache_hh
+#define NCPlugin_NXSHKLCache_hh
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCrystal/NCPluginBoilerplate.hh"
+#include "NCrystal/internal/infobld/NCInfoBuilder.hh"
+#include "NCNXSFSquare.hh"
+
+namespace NCPluginNamespace {
+
+  //Optional disk cache of computed hkl lists in a directory shared by several
+  //processes (typically node-local, like /dev/shm/somedir). It is enabled by
+  //setting the environment variable NCRYSTAL_NXSLIB_CACHEDIR to the
+  //directory. The first process to compute a given list publishes it as an
+  //immutable file (written under a temporary name and then renamed into
+  //place), and other processes read it back into their own hkl list instead
+  //of repeating the calculation. Only available on POSIX platforms.
+  //
+  //This only saves CPU time: each process still holds its own copy of the
+  //list, so memory usage per node is not reduced, and the background tables
+  //(see NCNXSBkgdTable.hh) are not cached.
+
+  struct HKLCacheKey {
+    std::uint64_t dataHash;//content hash of the input data, see hashTextData
+    double temperature;
+    unsigned maxhkl;
+    NC::PairDD dspacingRange;
+    double fsquareCut;//absolute |F|^2 cut applied [barn]
+    NXSFSquareOptions fsquareOptions;//engine used for |F|^2
+  };
+
+  //Returns the cache directory, or an empty string if the cache is disabled:
+  std::string hklCacheDir();
+
+  //Hash of the input data which (unlike its UID) is stable between processes:
+  std::uint64_t hashTextData( const NC::TextData& );
+
+  //Look up a previously published hkl list (returns NullOpt if not found):
+  NC::Optional<NC::HKLList> hklCacheLoad( const std::string& cachedir, const HKLCacheKey& );
+
+  //Publish an hkl list (failures are silently ignored):
+  void hklCacheStore( const std::string& cachedir, const HKLCacheKey&, const NC::HKLList& );
+
+}
+
+#endif
@@ -0,0 +1,214 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCNXSHKLTools.hh"
+#include "NCFactory_NXS.hh"
+#include "NCrystal/internal/utils/NCString.hh"
+#include <algorithm>
+#include <cmath>
+
+namespace NC = NCrystal;
+
+namespace NCPluginNamespace {
+  namespace {
+    double hklOptionValue( const NC::TextData& textData, const char * key, double maxval )
+    {
+      auto values = nxsKeyValues( textData, key );
+      if ( values.size() > 1 )
+        NCRYSTAL_THROW2(DataLoadError,"Multiple "<<key<<" entries in data: "<<textData.dataSourceName());
+      if ( values.empty() )
+        return 0.0;
+      double v;
+      if ( !NC::safe_str2dbl( NC::trim2( values.front() ), v ) || !( v >= 0.0 ) || !( v < maxval ) )
+        NCRYSTAL_THROW2(DataLoadError,"Invalid value of "<<key<<" (must be a relative tolerance in [0,"
+                        <<maxval<<")) in data: "<<textData.dataSourceName());
+      return v;
+    }
+
+    //Minimum over ranges of an array, supporting addition of a constant to
+    //all elements of a range, both in O(log(n)):
+    class RangeAddMinTree {
+    public:
+      RangeAddMinTree( const std::vector<double>& values )
+        : m_n( values.size() ), m_min( 4 * m_n ), m_add( 4 * m_n, 0.0 )
+      {
+        if ( m_n )
+          build( 1, 0, m_n, values );
+      }
+      void add( std::size_t begin, std::size_t end, double delta ) { add( 1, 0, m_n, begin, end, delta ); }
+      double min( std::size_t begin, std::size_t end ) const { return min( 1, 0, m_n, begin, end ); }
+    private:
+      void build( std::size_t node, std::size_t lo, std::size_t hi, const std::vector<double>& values )
+      {
+        if ( hi - lo == 1 ) {
+          m_min[node] = values[lo];
+          return;
+        }
+        const std::size_t mid = lo + ( hi - lo ) / 2;
+        build( 2*node, lo, mid, values );
+        build( 2*node+1, mid, hi, values );
+        m_min[node] = std::min( m_min[2*node], m_min[2*node+1] );
+      }
+      void add( std::size_t node, std::size_t lo, std::size_t hi, std::size_t begin, std::size_t end, double delta )
+      {
+        if ( end <= lo || hi <= begin )
+          return;
+        if ( begin <= lo && hi <= end ) {
+          m_min[node] += delta;
+          m_add[node] += delta;
+          return;
+        }
+        const std::size_t mid = lo + ( hi - lo ) / 2;
+        add( 2*node, lo, mid, begin, end, delta );
+        add( 2*node+1, mid, hi, begin, end, delta );
+        m_min[node] = std::min( m_min[2*node], m_min[2*node+1] ) + m_add[node];
+      }
+      double min( std::size_t node, std::size_t lo, std::size_t hi, std::size_t begin, std::size_t end ) const
+      {
+        if ( end <= lo || hi <= begin )
+          return NC::kInfinity;
+        if ( begin <= lo && hi <= end )
+          return m_min[node];
+        const std::size_t mid = lo + ( hi - lo ) / 2;
+        return std::min( min( 2*node, lo, mid, begin, end ),
+                         min( 2*node+1, mid, hi, begin, end ) ) + m_add[node];
+      }
+      std::size_t m_n;
+      std::vector<double> m_min;
+      std::vector<double> m_add;//pending addition to the whole subtree
+    };
+  }
+}
+
+NCP::NXSHKLOptions NCP::nxsHKLOptions( const NC::TextData& textData )
+{
+  NXSHKLOptions opts;
+  opts.mergeDTol = hklOptionValue( textData, "hkl_merge", 0.1 );
+  opts.pruneBudget = hklOptionValue( textData, "hkl_prune", 0.5 );
+  if ( opts.pruneBudget > 0.0 )
+    opts.fsquareCut = 0.0;
+  return opts;
+}
+
+NC::HKLList NCP::pruneHKLList( NC::HKLList&& in, double budget )
+{
+  const std::size_t n = in.size();
+  if ( !( budget > 0.0 ) || n < 2 )
+    return std::move(in);
+
+  //Families in order of decreasing d-spacing, grouped by equal d-spacing
+  //(each group starting a new Bragg edge):
+  std::vector<const NC::HKLInfo*> entries;
+  entries.reserve( n );
+  for ( auto& e : in )
+    entries.push_back( &e );
+  std::vector<std::size_t> byD( n );
+  for ( std::size_t i = 0; i < n; ++i )
+    byD[i] = i;
+  std::stable_sort( byD.begin(), byD.end(), [&entries]( std::size_t a, std::size_t b )
+                    { return entries[a]->dspacing > entries[b]->dspacing; } );
+  std::vector<double> weight( n );
+  std::vector<std::size_t> group( n );
+  std::vector<double> allowed;//budget times the cumulative weight at each edge
+  double cumulative = 0.0;
+  for ( std::size_t j = 0; j < n; ++j ) {
+    const NC::HKLInfo& e = *entries[byD[j]];
+    if ( j > 0 && e.dspacing != entries[byD[j-1]]->dspacing )
+      allowed.push_back( budget * cumulative );
+    weight[byD[j]] = e.multiplicity * e.fsquared * e.dspacing;
+    group[byD[j]] = allowed.size();
+    cumulative += weight[byD[j]];
+  }
+  allowed.push_back( budget * cumulative );
+  const std::size_t ngroups = allowed.size();
+
+  //Removing a family reduces the remaining budget at its own edge and all
+  //later (shorter wavelength) ones:
+  std::vector<std::size_t> byWeight( n );
+  for ( std::size_t i = 0; i < n; ++i )
+    byWeight[i] = i;
+  std::stable_sort( byWeight.begin(), byWeight.end(), [&weight]( std::size_t a, std::size_t b )
+                    { return weight[a] < weight[b]; } );
+  RangeAddMinTree remaining( allowed );
+  std::vector<char> removed( n, 0 );
+  for ( auto i : byWeight ) {
+    if ( remaining.min( group[i], ngroups ) < weight[i] )
+      continue;
+    remaining.add( group[i], ngroups, -weight[i] );
+    removed[i] = 1;
+  }
+
+  NC::HKLList out;
+  out.reserve_hint( n );
+  std::size_t i = 0;
+  for ( auto& e : in )
+    if ( !removed[i++] )
+      out.push_back( std::move(e) );
+  return out;
+}
+
+NC::HKLList NCP::mergeEqualDSpacings( NC::HKLList&& in, double dtol_rel )
+{
+  if ( !( dtol_rel > 0.0 ) || in.size() < 2 )
+    return std::move(in);
+  NC::HKLList out;
+  out.reserve_hint( in.size() );
+  auto it = in.begin();
+  auto itE = in.end();
+  while ( it != itE ) {
+    const double dtol = dtol_rel * it->dspacing;
+    auto itStrongest = it;
+    double sum_mf = 0.0;
+    unsigned sum_m = 0;
+    bool all_explicit = true;
+    auto itG = it;
+    for ( ; itG != itE && std::fabs( itG->dspacing - it->dspacing ) <= dtol; ++itG ) {
+      sum_mf += itG->multiplicity * itG->fsquared;
+      sum_m += itG->multiplicity;
+      all_explicit = all_explicit && itG->explicitValues != nullptr;
+      if ( itG->multiplicity * itG->fsquared > itStrongest->multiplicity * itStrongest->fsquared )
+        itStrongest = itG;
+    }
+    if ( !sum_m ) {
+      it = itG;
+      continue;
+    }
+    NC::HKLInfo hi;
+    hi.hkl = itStrongest->hkl;
+    hi.dspacing = itStrongest->dspacing;
+    hi.multiplicity = sum_m;
+    hi.fsquared = sum_mf / sum_m;
+    if ( all_explicit ) {
+      //Keep the list consistent, with the planes of all merged families:
+      hi.explicitValues = std::make_unique<NC::HKLInfo::ExplicitVals>();
+      for ( auto itM = it; itM != itG; ++itM )
+        for ( auto& e : itM->explicitValues->list )
+          hi.explicitValues->list.push_back( e );
+    }
+    out.push_back( std::move(hi) );
+    it = itG;
+  }
+  return out;
+}
+
+NC::HKLList NCP::applyHKLOptions( NC::HKLList&& hklList, const NXSHKLOptions& opts )
+{
+  return mergeEqualDSpacings( pruneHKLList( std::move(hklList), opts.pruneBudget ), opts.mergeDTol );
+}
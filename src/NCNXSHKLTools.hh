@@ -0,0 +1,73 @@
+#ifndef NCPlugin_NXSHKLTools_hh
+#define NCPlugin_NXSHKLTools_hh
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCrystal/NCPluginBoilerplate.hh"
+
+namespace NCPluginNamespace {
+
+  //Post-processing of the hkl lists produced from .nxs data, selected with
+  //keys in the data (see nxsHKLOptions below):
+
+  struct NXSHKLOptions {
+    //Merge families with d-spacings equal to within this relative tolerance
+    //(0 means no merging):
+    double mergeDTol = 0.0;
+    //Error budget of pruneHKLList (0 means no pruning):
+    double pruneBudget = 0.0;
+    //Families with |F|^2 [barn] below this are removed already when the list
+    //is produced. Defaults to the value hardcoded in NCrystal's .ncmat
+    //factory, but is disabled when pruning is enabled, since an absolute cut
+    //could remove significant families of weak scatterers:
+    double fsquareCut = 1e-5;
+  };
+
+  //Options from the "hkl_merge = <reltol>" and "hkl_prune = <budget>" keys of
+  //the data:
+  NXSHKLOptions nxsHKLOptions( const NC::TextData& );
+
+  //Removes as many families as possible from a list, such that the coherent
+  //elastic cross section (which is proportional to the sum of
+  //multiplicity*|F|^2*d over the families with 2d>wavelength) changes by at
+  //most the relative amount budget at any wavelength. Families are removed
+  //in order of increasing contribution, each only if the budget allows it at
+  //all wavelengths (a greedy approximation to the smallest possible list).
+  //The order of the remaining families is unchanged:
+  NC::HKLList pruneHKLList( NC::HKLList&&, double budget );
+
+  //Merges consecutive entries of a list sorted by d-spacing into one entry
+  //per group of (relative) width at most dtol_rel, with the summed
+  //multiplicity, the multiplicity-weighted average |F|^2 (so the sum of
+  //multiplicity*|F|^2 is preserved), and the hkl and d-spacing of the
+  //strongest family. Bragg edges and powder cross sections are thus unchanged
+  //(up to the tolerance), but the merged entries do not correspond to actual
+  //families, and are not suitable for single crystal models (explicit
+  //equivalent hkl lists are concatenated, to keep the list consistent).
+  NC::HKLList mergeEqualDSpacings( NC::HKLList&&, double dtol_rel );
+
+  //Applies the options (pruning before merging) to a freshly produced (or
+  //cached) list:
+  NC::HKLList applyHKLOptions( NC::HKLList&&, const NXSHKLOptions& );
+
+}
+
+#endif
@@ -48,6 +48,7 @@
 #include "NCNXSLib.hh"
 
 #include <cstdio>//Added by NCrystal developers for std::snprintf
+#include <chrono>//Added by NCrystal developers for NXS_HKLStats timings
 #include <math.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -182,6 +183,15 @@ namespace nxs {
   #define M_PI 3.14159265358979323846
 #endif
 
+/* batch size used for nxs_calcInvDhklSq() in nxs_initHKL() (added by NCrystal developers) */
+#define NXS_DHKL_BATCH 256
+
+/* wall-clock time in seconds, for NXS_HKLStats (added by NCrystal developers) */
+static double _wallclock()
+{
+  return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
 
 /* GLOBAL CONSTANTS */
 /*
@@ -411,77 +421,204 @@ double nxs_calcFSquare( NXS_HKL *hklReflex, NXS_UnitCell *uc )
 
 
 
+/* Helper added by NCrystal developers: 1/d^2 as a quadratic form in the
+   reciprocal metric tensor G* (stored as G*11,G*22,G*33,2G*12,2G*13,2G*23). */
+static inline double _quadFormRecipMetric( const double *G, double h, double k, double l )
+{
+  return h*( G[0]*h + G[3]*k + G[4]*l ) + k*( G[1]*k + G[5]*l ) + G[2]*l*l;
+}
+
+
 /**
- * \fn double nxs_calcDhkl( int h, int k, int l, NXS_UnitCell *uc )
- * \brief Calculates the lattice spacing.
+ * \fn static void _initRecipMetric( NXS_UnitCell *uc )
+ * \brief Calculates the reciprocal metric tensor of the unit cell.
  *
- * This function calculates the lattice spacing in &Aring; depending on the hkl Miller indices and the crystal system,
- * given via the NXS_UnitCell.
+ * Added by NCrystal developers. This function evaluates once per unit cell what nxs_calcDhkl() used to
+ * evaluate per reflection, using the lattice parameters relevant for the crystal system (e.g. only a for
+ * cubic crystals, since uc->b and uc->c might be 0 at this point). For the triclinic case the original
+ * per-reflection formula used sin(alpha) instead of sin^2(alpha) (etc.) and had a wrong prefactor on the
+ * hl term, which is fixed here.
  *
- * @param h Miller index h
- * @param k Miller index k
- * @param l Miller index l
- * @param uc NXS_UnitCell struct
- * @return d<sub>hkl</sub> [&Aring;]
+ * @param uc NXS_UnitCell struct (uc->volume must be set)
  */
-double nxs_calcDhkl( int h, int k, int l, NXS_UnitCell *uc )
+static void _initRecipMetric( NXS_UnitCell *uc )
 {
-  double d_spacing = 0.0;
   double a = uc->a;
   double b = uc->b;
   double c = uc->c;
-  /* Next 3 lines modified by NCrystal developers (original lines missed the factor of "*M_PI/180"): */
   double alpha = uc->alpha*M_PI/180;
   double beta = uc->beta*M_PI/180;
   double gamma = uc->gamma*M_PI/180;
-  double t1, t2, t3, t4, t5, t6;
+  double *G = uc->recipMetric;
+  double sinb2, V2inv;
+  unsigned int i;
 
-  //   h = abs(h);
-  //   k = abs(k);
-  //   l = abs(l);
+  for( i=0; i<6; i++ )
+    G[i] = 0.0;
 
   switch( uc->crystalSystem )
   {
     /* XS_Cubic */
-    case 7:   d_spacing = a / sqrt( (double)((h*h) + (k*k) + (l*l)) );
+    case 7:   G[0] = G[1] = G[2] = 1.0/(a*a);
               break;
-    /* XS_Hexagonal */
-    case 6:   d_spacing = a / sqrt( 4.0/3.0*(h*h + h*k + k*k) + (a*a/(c*c) * l*l) );
-              break;
-    /* XS_Trigonal */
-    case 5:   d_spacing = sqrt(3.0)*a*c / sqrt( 4.0*(h*h+k*k+h*k)*c*c + 3.0*l*l*a*a );
+    /* XS_Hexagonal and XS_Trigonal (hexagonal axes) */
+    case 6:
+    case 5:   G[0] = G[1] = G[3] = 4.0/(3.0*a*a);
+              G[2] = 1.0/(c*c);
               break;
     /* XS_Tetragonal */
-    case 4:   d_spacing = a / sqrt( h*h + k*k + a*a/(c*c)*l*l );
+    case 4:   G[0] = G[1] = 1.0/(a*a);
+              G[2] = 1.0/(c*c);
               break;
     /* XS_Orthorhombic */
-    case 3:   d_spacing = 1.0 / sqrt( h*h/a/a + k*k/b/b + l*l/c/c );
+    case 3:   G[0] = 1.0/(a*a);
+              G[1] = 1.0/(b*b);
+              G[2] = 1.0/(c*c);
               break;
-    /* XS_Monoclinic */
-    case 2:   d_spacing =  a*b*c*sqrt( 1.0-cos(beta)*cos(beta) ) / sqrt( b*b*c*c*h*h + a*a*c*c*k*k*sin(beta)*sin(beta) + a*a*b*b*l*l - 2.0*a*b*b*c*h*l*cos(beta) );
+    /* XS_Monoclinic (unique axis b) */
+    case 2:   sinb2 = 1.0-cos(beta)*cos(beta);
+              G[0] = 1.0/(a*a*sinb2);
+              G[1] = 1.0/(b*b);
+              G[2] = 1.0/(c*c*sinb2);
+              G[4] = -2.0*cos(beta)/(a*c*sinb2);
               break;
     /* XS_Triclinic */
-    case 1:   t1 = b*b*c*c * sin(alpha);
-              t2 = a*a*c*c * sin(beta);
-              t3 = a*a*b*b * sin(gamma);
-              t4 = a*b*c*c * ( cos(alpha)*cos(beta)-cos(gamma) );
-              t5 = a*a*b*c * ( cos(beta)*cos(gamma)-cos(alpha) );
-              t6 = b*b*c*c * ( cos(gamma)*cos(alpha)-cos(beta) );
-
-              d_spacing = 1.0/uc->volume/uc->volume * ( t1*h*h + t2*k*k + t3*l*l + 2.0*t4*h*k + 2.0*t5*k*l + 2.0*t6*h*l );
-              d_spacing = sqrt( 1.0 / d_spacing );
+    case 1:   V2inv = 1.0/uc->volume/uc->volume;
+              G[0] = V2inv * b*b*c*c * sin(alpha)*sin(alpha);
+              G[1] = V2inv * a*a*c*c * sin(beta)*sin(beta);
+              G[2] = V2inv * a*a*b*b * sin(gamma)*sin(gamma);
+              G[3] = V2inv * 2.0*a*b*c*c * ( cos(alpha)*cos(beta)-cos(gamma) );
+              G[4] = V2inv * 2.0*a*b*b*c * ( cos(gamma)*cos(alpha)-cos(beta) );
+              G[5] = V2inv * 2.0*a*a*b*c * ( cos(beta)*cos(gamma)-cos(alpha) );
               break;
     /* XS_Unknown */
     case 0:   break;
     default:  break;
   }
+}
+
+
+/**
+ * \fn double nxs_calcDhkl( int h, int k, int l, NXS_UnitCell *uc )
+ * \brief Calculates the lattice spacing.
+ *
+ * This function calculates the lattice spacing in &Aring; depending on the hkl Miller indices and the crystal system,
+ * given via the NXS_UnitCell.
+ * Modified by NCrystal developers to use the reciprocal metric tensor precomputed in nxs_initUnitCell().
+ *
+ * @param h Miller index h
+ * @param k Miller index k
+ * @param l Miller index l
+ * @param uc NXS_UnitCell struct
+ * @return d<sub>hkl</sub> [&Aring;]
+ */
+double nxs_calcDhkl( int h, int k, int l, NXS_UnitCell *uc )
+{
+  double inv_dsq = _quadFormRecipMetric( uc->recipMetric, (double)h, (double)k, (double)l );
+  /* XS_Unknown leaves the tensor at zero, in which case 0 is returned as before */
+  return inv_dsq > 0.0 ? 1.0/sqrt( inv_dsq ) : 0.0;
+}
+
 
-  return d_spacing;
+/**
+ * \fn void nxs_calcInvDhklSq( unsigned int n, const int *h, const int *k, const int *l, const NXS_UnitCell *uc, double *inv_dsq )
+ * \brief Calculates 1/d<sub>hkl</sub><sup>2</sup> for a batch of reflections.
+ *
+ * Added by NCrystal developers. The loop body is the same straight-line code for all crystal systems,
+ * allowing the compiler to vectorise it.
+ *
+ * @param n number of reflections
+ * @param h array of Miller indices h
+ * @param k array of Miller indices k
+ * @param l array of Miller indices l
+ * @param uc NXS_UnitCell struct
+ * @param inv_dsq output array of 1/d<sub>hkl</sub><sup>2</sup> [&Aring;<sup>-2</sup>]
+ */
+void nxs_calcInvDhklSq( unsigned int n, const int *h, const int *k, const int *l,
+                        const NXS_UnitCell *uc, double *inv_dsq )
+{
+  double G[6];
+  unsigned int i;
+  /* local copy, so the compiler knows the tensor is not modified via inv_dsq */
+  for( i=0; i<6; i++ )
+    G[i] = uc->recipMetric[i];
+  for( i=0; i<n; i++ )
+    inv_dsq[i] = _quadFormRecipMetric( G, (double)h[i], (double)k[i], (double)l[i] );
 }
 
 
 
 
+/* B_2k/(2k)! for k=1..18, with B_n the Bernoulli numbers (added by NCrystal developers) */
+static const double bernoulli_even_over_fact[18] = {
+  0.083333333333333329,
+  -0.0013888888888888889,
+  3.3068783068783071e-05,
+  -8.2671957671957675e-07,
+  2.08767569878681e-08,
+  -5.2841901386874932e-10,
+  1.3382536530684679e-11,
+  -3.3896802963225827e-13,
+  8.5860620562778452e-15,
+  -2.1748686985580619e-16,
+  5.5090028283602295e-18,
+  -1.3954464685812522e-19,
+  3.5347070396294673e-21,
+  -8.9535174270375463e-23,
+  2.2679524523376829e-24,
+  -5.7447906688722025e-26,
+  1.455172475614865e-27,
+  -3.6859949406653103e-29
+};
+
+/**
+ * \fn static double _debyeIntegral( int m, double X )
+ * \brief Calculates the integral of t<sup>m</sup>/(e<sup>t</sup>-1) from 0 to X for m=1 or m=3 (added by NCrystal developers).
+ *
+ * For X<2 the Bernoulli series of t/(e<sup>t</sup>-1) is integrated term by term (converging at least like
+ * (X/2&pi;)<sup>2k</sup>), otherwise the integral is m!&zeta;(m+1) minus a sum of terms falling like e<sup>-nX</sup>. Both
+ * are accurate to ~1e-15 relative with at most 18 terms.
+ *
+ * @param m 1 or 3
+ * @param X upper limit
+ * @return integral value
+ */
+static double _debyeIntegral( int m, double X )
+{
+  const double mfact_zeta = ( m==1 ? M_PI*M_PI/6.0 : 6.0*M_PI*M_PI*M_PI*M_PI/90.0 );
+  double sum, y, p;
+  int k, n;
+
+  if( X < 2.0 )
+  {
+    y = X*X;
+    p = 0.0;
+    for( k=17; k>=0; --k )
+      p = p*y + bernoulli_even_over_fact[k]/(2*k+2+m);
+    sum = 1.0/m - X/(2.0*(m+1)) + y*p;
+    return ( m==1 ? X : X*y ) * sum;
+  }
+
+  sum = 0.0;
+  for( n=1; n<100; ++n )
+  {
+    double inv_n = 1.0/n;
+    double e = exp(-n*X);
+    double term;
+    if( e == 0.0 )
+      break;
+    if( m == 1 )
+      term = e * inv_n*( X + inv_n );
+    else
+      term = e * inv_n*( X*X*X + inv_n*( 3.0*X*X + inv_n*( 6.0*X + 6.0*inv_n ) ) );
+    sum += term;
+    if( term < 1e-17*mfact_zeta )
+      break;
+  }
+  return mfact_zeta - sum;
+}
+
+
 /**
  * \fn static double _calcPhi_1( double theta )
  * \brief Calculates &phi;<sub>1</sub>(&theta;) as shown by Vogel (2000).
@@ -489,32 +626,17 @@ double nxs_calcDhkl( int h, int k, int l, NXS_UnitCell *uc )
  * References:
  *  - S. Vogel (2000) Thesis, Kiel University, Germany.
  *
+ * Modified by NCrystal developers to evaluate the Debye integral with _debyeIntegral() rather than by summing a
+ * slowly converging series until successive terms differed by less than 1E-6 (which was both slow and inaccurate
+ * for large &theta;).
+ *
  * @param theta = T/&theta;<sub>D</sub>
  * @return &phi;<sub>1</sub>(&theta;)
  */
 static double _calcPhi_1( double theta )
 {
-  double phi_1, a_n, step1, step2, n, riemann_zeta_2, I_m;
-
-  step1 = 1.0;
-  step2 = 0.0;
-  n = 1.0;
-  a_n = 0.0;
-  while ( fabs(step1-step2)>1E-6 )
-  {
-    step1 = step2;
-    step2 = 1.0/( exp(n/theta)*n*n );
-
-    a_n += step2;
-    n = n + 1.0;
-  }
-
-  riemann_zeta_2 = M_PI*M_PI/6.0;
-  I_m = theta * log( 1.0-exp(-1.0/theta) ) + theta*theta * (riemann_zeta_2 - a_n);
-
-  phi_1 = 0.5 + 2.0*I_m;
-
-  return phi_1;
+  double I_m = theta*theta * _debyeIntegral( 1, 1.0/theta );
+  return 0.5 + 2.0*I_m;
 }
 
 
@@ -527,34 +649,16 @@ static double _calcPhi_1( double theta )
  * References:
  *  - S. Vogel (2000) Thesis, Kiel University, Germany.
  *
+ * Modified by NCrystal developers to use _debyeIntegral(), as for _calcPhi_1().
+ *
  * @param theta = T/&theta;<sub>D</sub>
  * @return &phi;<sub>3</sub>(&theta;)
  */
 static double _calcPhi_3( double theta )
 {
-  double phi_3;
-
-  double a_n, step1, step2, n, riemann_zeta_4, I_m;
-
-  step1 = 1.0;
-  step2 = 0.0;
-  n = 1.0;
-  a_n = 0.0;
-  while ( fabs(step1-step2)>1E-6 )
-  {
-    step1 = step2;
-    step2 = 1.0/( exp(n/theta)*n*n ) * ( 0.5+theta/n+theta*theta/n/n );
-
-    a_n += step2;
-    n = n + 1.0;
-  }
-
-  riemann_zeta_4 = M_PI*M_PI*M_PI*M_PI/90.0;
-  I_m = theta * log( 1.0-exp(-1.0/theta) ) + 6.0*theta*theta * (riemann_zeta_4*theta*theta - a_n);
-
-  phi_3 = 0.25 + 2.0*I_m;
-
-  return phi_3;
+  double theta_sq = theta*theta;
+  double I_m = theta_sq*theta_sq * _debyeIntegral( 3, 1.0/theta );
+  return 0.25 + 2.0*I_m;
 }
 
 
@@ -645,6 +749,9 @@ int nxs_initUnitCell( NXS_UnitCell *uc )
     default:  break;
   }
 
+  /* Next line added by NCrystal developers: */
+  _initRecipMetric( uc );
+
   /*
   printf( "\n# --------------------\n# ");
   PrintFullHM_SgName(tsgn, ' ', stdout);
@@ -678,42 +785,71 @@ int nxs_initUnitCell( NXS_UnitCell *uc )
 
 
 /* implementation of R factors by Th. Kittelmann after A.K. Freund (1983) Nucl. Instr. Meth. 213, 495-501 */
-static double rfacts[23] = {0};
-
-static void initRfacts()
-{
-  // Bernoulli numbers B_n (only for n = 0...23)
-  double bernoulli[23] = { 1, -1./2, 1./6, 0., -1./30., 0., 1./42, 0.,
-                           -1./30., 0., 5./66, 0., -691./2730., 0.,
-                           7./6, 0., -3617./510., 0., 43867./798, 0.,
-                           -174611./330., 0., 854513./138 };
-  double nfact = 1.0;
-  unsigned int n;
-  for( n=0; n <= 22; ++n )
-  {
-    if (n)
-      nfact *= n;
-    rfacts[n] = bernoulli[n] / (nfact*(n+5.0/2.0));
-  }
-}
+/* The coefficients are B_n/(n!*(n+5/2)) with B_n the Bernoulli numbers. As    */
+/* B_n=0 for odd n>1, only the terms with even n>=2 are tabulated (modified by  */
+/* NCrystal developers to use a constant table rather than one initialised on   */
+/* first use, since that was not thread-safe):                                  */
+static const double rfacts_even[11] = {
+  0.018518518518518517,      /* B_2/(2!*4.5) */
+  -0.00021367521367521368,   /* B_4/(4!*6.5) */
+  3.8904450669156552e-06,    /* B_6/(6!*8.5) */
+  -7.8735197782816835e-08,   /* B_8/(8!*10.5) */
+  1.6701405590294479e-09,    /* B_10/(10!*12.5) */
+  -3.6442690611637883e-11,   /* B_12/(12!*14.5) */
+  8.110628200414957e-13,     /* B_14/(14!*16.5) */
+  -1.8322596196338285e-14,   /* B_16/(16!*18.5) */
+  4.1883229542818756e-16,    /* B_18/(18!*20.5) */
+  -9.6660831047024977e-18,   /* B_20/(20!*22.5) */
+  1.1242862915020877e-19     /* B_22/(22!*24.5)/2 */
+};
 
 static double calcR(double x)
 {
-  double sum = 0.0;
-  double xx = 1.0/x;
-  unsigned int n;
+  /* R(x) = sum_{n=0}^{21} B_n/(n!*(n+5/2)) x^(n-1) + 1/2 B_22/(22!*24.5) x^21,  */
+  /* evaluated as 2/5x - 1/7 + x*P(x^2) with P in Horner form (modified by       */
+  /* NCrystal developers):                                                      */
+  const double y = x*x;
+  double p = rfacts_even[10];
+  int k;
+  for( k=9; k>=0; --k )
+    p = p*y + rfacts_even[k];
+  return 0.4/x - 1.0/7.0 + x*p;
+}
 
-  // This is done only once at the beginning
-  if( !rfacts[0] )
-    initRfacts();
 
-  for (n=0;n<22;++n)
+/**
+ * \fn static void _initTemperatureFactors( NXS_UnitCell *uc, NXS_AtomInfo *ai )
+ * \brief Sets the temperature dependent factors sph, phi_1, B_iso and phi_3 of an atom (split out of
+ * nxs_addAtomInfo() by NCrystal developers, for use also by nxs_setTemperature()).
+ *
+ * The factors only depending on x=&theta;<sub>D</sub>/T are shared by all atoms (cached in uc->debyeFactors).
+ *
+ * @param uc NXS_UnitCell struct
+ * @param ai NXS_AtomInfo struct with molarMass and M_m set
+ */
+static void _initTemperatureFactors( NXS_UnitCell *uc, NXS_AtomInfo *ai )
+{
+  double x = uc->debyeTemp/uc->temperature;
+  if( uc->debyeFactors.x != x )
   {
-    sum += xx * rfacts[n];
-    xx *= x;
+    NXS_DebyeFactors *df = &(uc->debyeFactors);
+    if( x <= 6 )
+      df->sph_factor = calcR(x);
+    else
+      df->sph_factor = 3.29708964927644 * pow(x,-3.5);
+    df->phi_1 = _calcPhi_1( 1/x );
+    df->phi_3 = _calcPhi_3( 1/x );
+    df->x = x;
   }
-  sum += 0.5 * xx * rfacts[22];
-  return sum;
+
+  // Single phonon part after A.K. Freund (1983) Nucl. Instr. Meth. 213, 495-501
+  ai->sph =  sqrt( uc->debyeTemp ) / ai->M_m;
+  ai->sph *= uc->debyeFactors.sph_factor;
+
+  // from S. Vogel (2000) Thesis, Kiel University
+  ai->phi_1 = uc->debyeFactors.phi_1;
+  ai->B_iso = 5.7451121E3 * ai->phi_1 / ai->molarMass / uc->debyeTemp;
+  ai->phi_3 = uc->debyeFactors.phi_3;
 }
 
 
@@ -730,8 +866,6 @@ static double calcR(double x)
  */
 int nxs_addAtomInfo( NXS_UnitCell *uc, NXS_AtomInfo ai )
 {
-  double x;
-
   /* if debyeTemp was not given as a parameter */
   if( uc->debyeTemp<1E-6 )
   {
@@ -749,19 +883,7 @@ int nxs_addAtomInfo( NXS_UnitCell *uc, NXS_AtomInfo ai )
   //ai.M_m = ai.molarMass*ATOMIC_MASS_U_kg/MASS_NEUTRON_kg;
   ai.M_m = ai.molarMass * 0.99140954426;
 
-  // Single phonon part after A.K. Freund (1983) Nucl. Instr. Meth. 213, 495-501
-  ai.sph =  sqrt( uc->debyeTemp ) / ai.M_m;
-
-  x = uc->debyeTemp/uc->temperature;
-  if( x <= 6 )
-    ai.sph *= calcR(x);
-  else
-    ai.sph *= 3.29708964927644 * pow(x,-3.5);
-
-  // from S. Vogel (2000) Thesis, Kiel University
-  ai.phi_1 = _calcPhi_1( 1/x );
-  ai.B_iso = 5.7451121E3 * ai.phi_1 / ai.molarMass / uc->debyeTemp;
-  ai.phi_3 = _calcPhi_3( 1/x );
+  _initTemperatureFactors( uc, &ai );
 
   uc->atomInfoList[uc->nAtomInfo-1] = ai;
   _generateWyckoffPositions( uc );
@@ -785,25 +907,38 @@ int nxs_addAtomInfo( NXS_UnitCell *uc, NXS_AtomInfo ai )
 
 
 /**
- * \fn int nxs_initHKL( NXS_UnitCell *uc )
- * \brief Initializes the hkl lattice planes.
+ * \fn void nxs_setTemperature( NXS_UnitCell *uc, double temperature )
+ * \brief Changes the temperature of a unit cell with all atoms already added (added by NCrystal developers).
  *
- * This function uses SgInfo library functions to initialise the hkl planes and implicitly calculates
- * the unit cell density, the C2 multi-phonon constant (if not given by the user before), average
- * coherent and incoherent cross section value and stores equivalent hkl lattice planes (if any) per hkl.
+ * Updates the temperature dependent factors of all atoms, so the cross section functions can be evaluated at a new
+ * temperature without setting up the unit cell again. Any hkl list (and its structure factors) is NOT updated.
+ *
+ * @param uc NXS_UnitCell struct
+ * @param temperature new temperature [K]
+ */
+void nxs_setTemperature( NXS_UnitCell *uc, double temperature )
+{
+  unsigned int i;
+  uc->temperature = temperature;
+  for( i=0; i<uc->nAtomInfo; i++ )
+    _initTemperatureFactors( uc, &(uc->atomInfoList[i]) );
+}
+
+
+/**
+ * \fn void nxs_initAverageSigma( NXS_UnitCell *uc, int fix_incoh_xs )
+ * \brief Calculates average coherent and incoherent cross sections of the unit cell.
+ *
+ * Split out of nxs_initHKL() by NCrystal developers, so the quantities needed by the non-Bragg cross
+ * section functions can be initialised without the (expensive) hkl lattice plane enumeration.
  *
  * @param uc UnitCell struct
- * @return nxs error code
+ * @param fix_incoh_xs see nxs_initHKL()
  */
-/* fix_incoh_xs parameter added in next line NCrystal developers (see header file for explanation): */
-int nxs_initHKL( NXS_UnitCell *uc, int fix_incoh_xs )
+void nxs_initAverageSigma( NXS_UnitCell *uc, int fix_incoh_xs )
 {
-  unsigned int ai, i,j;
+  unsigned int ai;
   double tmp;
-  T_SgInfo SgInfo;
-  int minH, minK, minL, max_hkl, restriction, h,k,l;
-  NXS_HKL *hkl;
-  unsigned long index_count;
 
   /*
   int pos;
@@ -838,6 +973,51 @@ int nxs_initHKL( NXS_UnitCell *uc, int fix_incoh_xs )
   if ( ! fix_incoh_xs )
   uc->avgSigmaIncoherent += 0.04*M_PI * ( tmp - uc->avgSigmaCoherent );
   uc->avgSigmaCoherent *= 0.04*M_PI;
+}
+
+
+/**
+ * \fn int nxs_initHKL( NXS_UnitCell *uc )
+ * \brief Initializes the hkl lattice planes.
+ *
+ * This function uses SgInfo library functions to initialise the hkl planes and implicitly calculates
+ * the unit cell density, the C2 multi-phonon constant (if not given by the user before), average
+ * coherent and incoherent cross section value and stores equivalent hkl lattice planes (if any) per hkl.
+ * Modified by NCrystal developers to simply call nxs_initAverageSigma() and nxs_initHKLList().
+ *
+ * @param uc UnitCell struct
+ * @return nxs error code
+ */
+/* fix_incoh_xs parameter added in next line NCrystal developers (see header file for explanation): */
+int nxs_initHKL( NXS_UnitCell *uc, int fix_incoh_xs )
+{
+  nxs_initAverageSigma( uc, fix_incoh_xs );
+  return nxs_initHKLList( uc );
+}
+
+
+/**
+ * \fn int nxs_initHKLList( NXS_UnitCell *uc )
+ * \brief Initializes the hkl lattice planes, without touching the average cross sections.
+ *
+ * Split out of nxs_initHKL() by NCrystal developers. Enumerates the permitted reflections up to
+ * uc->maxHKL_index, calculates their multiplicities, d-spacings and |F|^2, stores equivalent hkl
+ * lattice planes per hkl and sorts the result by d-spacing.
+ *
+ * @param uc UnitCell struct
+ * @return nxs error code
+ */
+int nxs_initHKLList( NXS_UnitCell *uc )
+{
+  unsigned int i,j;
+  T_SgInfo SgInfo;
+  int minH, minK, minL, max_hkl, restriction, h,k,l;
+  NXS_HKL *hkl;
+  unsigned long index_count;
+  /* timings and counters added by NCrystal developers: */
+  NXS_HKLStats *stats = &(uc->hklStats);
+  double t0 = _wallclock(), t1;
+  memset( stats, 0, sizeof(*stats) );
 
   /* some initialization for SgInfo */
   SgInfo = uc->sgInfo;
@@ -853,6 +1033,8 @@ int nxs_initHKL( NXS_UnitCell *uc, int fix_incoh_xs )
   hkl = (NXS_HKL*)malloc(  sizeof(NXS_HKL)*index_count );
   if( !hkl )
     return NXS_ERROR_MEMORYALLOCATIONFAILED;
+  stats->nCandidates = index_count;
+  stats->bytesAllocated = sizeof(NXS_HKL)*index_count;
 
   i = 0;
 
@@ -871,6 +1053,8 @@ int nxs_initHKL( NXS_UnitCell *uc, int fix_incoh_xs )
       /* exclude (hkl)=(000) */
       if( h==0 && k==0 && l==0 )
         continue;
+      stats->nNotSysAbsent++;
+      stats->nSymEquivTests += i;
 
       hkl[i].h = h;
       hkl[i].k = k;
@@ -912,6 +1096,9 @@ int nxs_initHKL( NXS_UnitCell *uc, int fix_incoh_xs )
     return NXS_ERROR_MEMORYALLOCATIONFAILED;
   }
   hkl = realloc_hkl;
+  t1 = _wallclock();
+  stats->timeEnumerate = t1 - t0;
+  t0 = t1;
 
   for( i=0; i<uc->nHKL; i++ )
   {
@@ -924,6 +1111,7 @@ int nxs_initHKL( NXS_UnitCell *uc, int fix_incoh_xs )
     equivHKL = (NXS_EquivHKL*)malloc( sizeof(NXS_EquivHKL)*eqHKL.N );
     if( !equivHKL )
       return free(hkl),NXS_ERROR_MEMORYALLOCATIONFAILED;/* "free(hkl)," added by NCrystal developers to fix potential leak detected by static code analysis */
+    stats->bytesAllocated += sizeof(NXS_EquivHKL)*eqHKL.N;
 
 
     nEqHKL = eqHKL.N;
@@ -934,15 +1122,58 @@ int nxs_initHKL( NXS_UnitCell *uc, int fix_incoh_xs )
       equivHKL[j].l = eqHKL.l[j];
     }
     hkl[i].equivHKL = equivHKL;
-
-    /* get d-spacing and |F|^2 */
-    hkl[i].dhkl = nxs_calcDhkl( hkl[i].h, hkl[i].k, hkl[i].l, uc );
-    hkl[i].FSquare = nxs_calcFSquare( &(hkl[i]), uc );
+    hkl[i].nEquivHKL = nEqHKL;/* added by NCrystal developers */
   }
+  t1 = _wallclock();
+  stats->timeEquivHKL = t1 - t0;
+  t0 = t1;
+
+  /* get d-spacing (in batches, modified by NCrystal developers) and |F|^2 */
+  for( i=0; i<uc->nHKL; i+=NXS_DHKL_BATCH )
+  {
+    int bh[NXS_DHKL_BATCH], bk[NXS_DHKL_BATCH], bl[NXS_DHKL_BATCH];
+    double inv_dsq[NXS_DHKL_BATCH];
+    unsigned int nb = uc->nHKL - i < NXS_DHKL_BATCH ? uc->nHKL - i : NXS_DHKL_BATCH;
+    for( j=0; j<nb; j++ )
+    {
+      bh[j] = hkl[i+j].h;
+      bk[j] = hkl[i+j].k;
+      bl[j] = hkl[i+j].l;
+    }
+    nxs_calcInvDhklSq( nb, bh, bk, bl, uc, inv_dsq );
+    for( j=0; j<nb; j++ )
+      hkl[i+j].dhkl = inv_dsq[j] > 0.0 ? 1.0/sqrt( inv_dsq[j] ) : 0.0;
+  }
+  t1 = _wallclock();
+  stats->timeDhkl = t1 - t0;
+  t0 = t1;
+  /* optional replacement of the loop below added by NCrystal developers: */
+  if( uc->calcFSquareList )
+    uc->calcFSquareList( hkl, uc->nHKL, uc, uc->calcFSquareListData );
+  else
+    for( i=0; i<uc->nHKL; i++ )
+      hkl[i].FSquare = nxs_calcFSquare( &(hkl[i]), uc );
   /* end of initalizing */
+  t1 = _wallclock();
+  stats->timeFSquare = t1 - t0;
+  t0 = t1;
 
   /* sort hkl lattice planes by d_hkl */
   qsort( hkl, uc->nHKL, sizeof(NXS_HKL), _dhkl_compare );
+  stats->timeSort = _wallclock() - t0;
+
+  /* cumulative sums for nxs_CoherentElastic (added by NCrystal developers, */
+  /* if the allocation fails nxs_CoherentElastic simply scans the list,     */
+  /* and any sums of a previous call are released first):                   */
+  free( uc->hklCumFMd );
+  uc->hklCumFMd = (double*)malloc( sizeof(double)*(uc->nHKL+1) );
+  if( uc->hklCumFMd )
+  {
+    stats->bytesAllocated += sizeof(double)*(uc->nHKL+1);
+    uc->hklCumFMd[0] = 0.0;
+    for( i=0; i<uc->nHKL; i++ )
+      uc->hklCumFMd[i+1] = uc->hklCumFMd[i] + hkl[i].FSquare * hkl[i].multiplicity * hkl[i].dhkl;
+  }
 
   uc->hklList = hkl;
   return NXS_ERROR_OK;
@@ -952,6 +1183,37 @@ int nxs_initHKL( NXS_UnitCell *uc, int fix_incoh_xs )
 
 
 
+/**
+ * \fn static double _coherentElasticEdgeCorrection( double lambda, NXS_UnitCell* uc, unsigned int n )
+ * \brief Correction to the sum over the first n planes (added by NCrystal developers).
+ *
+ * d-spacings within 1E-6 of each other are ordered by FSquare*multiplicity in
+ * _dhkl_compare, so right at a Bragg edge the sorted list does not strictly
+ * separate contributing and non-contributing planes. Given the number n of
+ * planes before the edge found by a search in the list, this returns the
+ * correction for planes near the threshold which are on the wrong side of n.
+ *
+ * @param lambda wavelength in &Aring;
+ * @param uc NXS_UnitCell struct
+ * @param n number of planes before the edge
+ * @return correction to the sum of FSquare*multiplicity*dhkl
+ */
+static double _coherentElasticEdgeCorrection( double lambda, NXS_UnitCell* uc, unsigned int n )
+{
+  NXS_HKL *hkl = uc->hklList;
+  double corr = 0.0;
+  unsigned int i;
+  for( i=n; i-- > 0 && fabs(lambda - 2.0*hkl[i].dhkl - 1E-6) < 1E-4; )
+    if( !(lambda - 2.0*hkl[i].dhkl < 1E-6) )
+      corr -= hkl[i].FSquare * hkl[i].multiplicity * hkl[i].dhkl;
+  for( i=n; i<uc->nHKL && fabs(lambda - 2.0*hkl[i].dhkl - 1E-6) < 1E-4; ++i )
+    if( lambda - 2.0*hkl[i].dhkl < 1E-6 )
+      corr += hkl[i].FSquare * hkl[i].multiplicity * hkl[i].dhkl;
+  return corr;
+}
+
+
+
 /**
  * \fn double nxs_CoherentElastic( double lambda, NXS_UnitCell* uc )
  * \brief Calculates the coherent elastic scattering cross section.
@@ -968,13 +1230,33 @@ double nxs_CoherentElastic( double lambda, NXS_UnitCell* uc )
 
   /* for all d-spacings... */
   unsigned int i;
-  for( i=0; i<uc->nHKL; ++i )
+  if( uc->hklCumFMd )
+  {
+    /* The list is sorted by decreasing d-spacing, so the contributing    */
+    /* planes are the first n ones, with n found by a binary search, and  */
+    /* the sum is taken from the cumulative sums (added by NCrystal        */
+    /* developers, previously the whole list was scanned for every call): */
+    unsigned int lo = 0, hi = uc->nHKL;
+    while( lo < hi )
+    {
+      unsigned int mid = lo + (hi-lo)/2;
+      if( lambda - 2.0*hkl[mid].dhkl < 1E-6 )
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    xsect_coh_el = uc->hklCumFMd[lo] + _coherentElasticEdgeCorrection( lambda, uc, lo );
+  }
+  else
   {
-    double delta = lambda - 2.0*hkl[i].dhkl;
-    if( delta<1E-6 )
+    for( i=0; i<uc->nHKL; ++i )
     {
-      /* calculate the elastic coherent cross section */
-      xsect_coh_el += hkl[i].FSquare * hkl[i].multiplicity * hkl[i].dhkl;
+      double delta = lambda - 2.0*hkl[i].dhkl;
+      if( delta<1E-6 )
+      {
+        /* calculate the elastic coherent cross section */
+        xsect_coh_el += hkl[i].FSquare * hkl[i].multiplicity * hkl[i].dhkl;
+      }
     }
   }
   /* this is our final coherent elastic scattering cross section */
@@ -986,6 +1268,49 @@ double nxs_CoherentElastic( double lambda, NXS_UnitCell* uc )
 
 
 
+/**
+ * \fn int nxs_CoherentElasticSweep( unsigned int n, const double *lambda, NXS_UnitCell* uc, double *xsect )
+ * \brief Calculates the coherent elastic scattering cross section on a wavelength grid.
+ *
+ * Added by NCrystal developers. Equivalent to calling nxs_CoherentElastic()
+ * for each of the n wavelengths, but the grid must be sorted in ascending
+ * order, and the planes are visited in a single sweep down the grid rather
+ * than searched for at each point, so the cost is O(n+nHKL).
+ *
+ * @param n number of wavelengths
+ * @param lambda wavelengths in &Aring; (ascending)
+ * @param uc NXS_UnitCell struct
+ * @param xsect output array of n cross sections [barn = 10<sup>-24</sup> cm<sup>2</sup>]
+ * @return int error code, NXS_ERROR_UNSORTEDINPUT if lambda is not sorted
+ */
+int nxs_CoherentElasticSweep( unsigned int n, const double *lambda, NXS_UnitCell* uc, double *xsect )
+{
+  NXS_HKL *hkl = uc->hklList;
+  double sum = 0.0;
+  unsigned int i, ihkl = 0;
+
+  for( i=1; i<n; ++i )
+    if( !(lambda[i-1] <= lambda[i]) )
+      return NXS_ERROR_UNSORTEDINPUT;
+
+  /* decreasing wavelengths, so planes are only added to the sum */
+  for( i=n; i-- > 0; )
+  {
+    while( ihkl<uc->nHKL && lambda[i] - 2.0*hkl[ihkl].dhkl < 1E-6 )
+    {
+      sum += hkl[ihkl].FSquare * hkl[ihkl].multiplicity * hkl[ihkl].dhkl;
+      ++ihkl;
+    }
+    /* use the cumulative sums when available, for results identical to nxs_CoherentElastic */
+    xsect[i] = ( uc->hklCumFMd ? uc->hklCumFMd[ihkl] : sum ) + _coherentElasticEdgeCorrection( lambda[i], uc, ihkl );
+    xsect[i] = xsect[i]*1E-2 * lambda[i]*lambda[i] / (2.0*uc->volume);
+  }
+  return NXS_ERROR_OK;
+}
+
+
+
+
 /**
  * \fn double nxs_Absorption( double lambda, NXS_UnitCell* uc )
  * \brief Calculates the absorbtion cross section.
@@ -1384,6 +1709,8 @@ NXS_MarchDollase nxs_initMarchDollase( NXS_UnitCell* uc )
   md.nOrientations = 0;
   md.texture = NULL;
   md.unitcell = uc;
+  md.nCorrGrid = 0;
+  md.corrTable = NULL;
 
   /* calculate sin_phi and cos_phi */
   md.sin_phi = (double*)malloc( sizeof(double)*md.N );
@@ -1509,55 +1836,18 @@ double nxs_CoherentElasticTexture( double lambda, NXS_MarchDollase* md )
 
   NXS_UnitCell *uc = md->unitcell;
   NXS_HKL *hkl = uc->hklList;
-  NXS_Texture *texture = md->texture;
-  unsigned int nEquivalent;
 
   /* for all d-spacings... */
-  unsigned int i, j, k, l;
+  unsigned int i;
 
   for( i=0; i<uc->nHKL; i++ )
   {
     double delta = lambda - 2.0*hkl[i].dhkl;
     if( delta < -1E-6 )
     {
-      double alpha_h, sin_alpha_h, cos_alpha_h,  cos_beta, sin_beta;
-      double corr = 0.0;
-      nEquivalent = hkl[i].multiplicity / 2;
-      if( nEquivalent==0 ) nEquivalent = 1;
-
-      /* calculate alpha_h */
-      alpha_h = M_PI/2.0 - asin( lambda/2.0/hkl[i].dhkl );
-      sin_alpha_h = sin( alpha_h );
-      cos_alpha_h = cos( alpha_h );
-
-      /* calculate the correction factor... */
-      for( j=0; j<md->nOrientations; j++ )
-      {
-        for( k=0; k<nEquivalent; k++ )
-        {
-          cos_beta = texture[j].cos_beta[i][k];
-          sin_beta = texture[j].sin_beta[i][k];
-          for( l=0; l<md->N; l++ )
-          {
-            double sin_phi, a, cos_alpha_H;
-            unsigned int index;
-            sin_phi = md->sin_phi[l];
-            // double cos_phi = md->cos_phi[l];
-
-            a = cos_beta*cos_alpha_h - sin_beta*sin_alpha_h*sin_phi;
-            //             double b = sin_beta*cos_phi;
-            //             double c = cos_beta*sin_alpha_h + sin_beta*cos_alpha_h*sin_phi;
-            cos_alpha_H = a/* + b + c*/;
-            //             cos_alpha_H = a*x+b*y+c*z;
-
-            index = (int)( (1.0+cos_alpha_H)/2.0*(double)md->M );
-            corr += md->texture[j].P_alpha_H[index] * md->texture[j].f;
-          }
-        } /* end of nEquivalent */
-      } /* end of nOrientations */
-
       /* calculate the elastic coherent cross section with texture influence */
-      corr = corr / (double)(nEquivalent);
+      /* (correction factor moved to nxs_TextureCorrection by NCrystal developers) */
+      double corr = nxs_TextureCorrection( i, lambda, md );
       xsect_coh_el += hkl[i].FSquare * hkl[i].multiplicity * hkl[i].dhkl * corr;
     }
   } /* end of hkls */
@@ -1569,6 +1859,161 @@ double nxs_CoherentElasticTexture( double lambda, NXS_MarchDollase* md )
 }
 
 
+/**
+ * \fn static double _textureCorrection( unsigned int i, double cos_alpha_h, double sin_alpha_h, NXS_MarchDollase* md )
+ * \brief March-Dollase correction factor of a given plane (added by NCrystal developers).
+ *
+ * This is the integration over all orientations, equivalent planes and azimuth angles which was
+ * previously done inline in nxs_CoherentElasticTexture().
+ * @param i index of the plane in the hkl list
+ * @param cos_alpha_h cosine of the angle between beam and scattering vector (i.e. lambda/(2 d_hkl))
+ * @param sin_alpha_h sine of the same angle
+ * @param md NXS_MarchDollase struct
+ * @return correction factor
+ */
+static double _textureCorrection( unsigned int i, double cos_alpha_h, double sin_alpha_h, NXS_MarchDollase* md )
+{
+  NXS_HKL *hkl = md->unitcell->hklList;
+  NXS_Texture *texture = md->texture;
+  double corr = 0.0;
+  unsigned int j, k, l;
+  unsigned int nEquivalent = hkl[i].multiplicity / 2;
+  if( nEquivalent==0 ) nEquivalent = 1;
+
+  /* calculate the correction factor... */
+  for( j=0; j<md->nOrientations; j++ )
+  {
+    const double *P_alpha_H = texture[j].P_alpha_H;
+    double corr_j = 0.0;
+    for( k=0; k<nEquivalent; k++ )
+    {
+      double cos_beta = texture[j].cos_beta[i][k];
+      double a0 = cos_beta*cos_alpha_h;
+      double a1 = texture[j].sin_beta[i][k]*sin_alpha_h;
+      for( l=0; l<md->N; l++ )
+      {
+        double cos_alpha_H = a0 - a1*md->sin_phi[l];
+        unsigned int index = (unsigned int)( (1.0+cos_alpha_H)/2.0*(double)md->M );
+        /* clamp added by NCrystal developers (index==M for cos_alpha_H==1) */
+        if( index>=md->M ) index = md->M-1;
+        corr_j += P_alpha_H[index];
+      }
+    } /* end of nEquivalent */
+    corr += corr_j * texture[j].f;
+  } /* end of nOrientations */
+
+  return corr / (double)(nEquivalent);
+}
+
+
+/**
+ * \fn int nxs_initTextureTable( NXS_MarchDollase* md, unsigned int nGrid )
+ * \brief Tabulates the texture correction factors of all planes (added by NCrystal developers).
+ *
+ * For each plane the correction factor is tabulated at nGrid points uniformly spaced in
+ * s=sqrt(1-lambda/(2 d_hkl)) from 0 (at the Bragg edge) to 1 (lambda=0). This variable is
+ * used rather than lambda itself, since the correction factor varies as the square root
+ * of the distance to the edge close to it.
+ * @param md NXS_MarchDollase struct with all textures added
+ * @param nGrid number of grid points per plane (at least 2)
+ * @return int error code
+ */
+int nxs_initTextureTable( NXS_MarchDollase* md, unsigned int nGrid )
+{
+  NXS_UnitCell *uc = md->unitcell;
+  unsigned int i, g;
+  double *table;
+
+  if( nGrid<2 )
+    nGrid = 2;
+  table = (double*)malloc( sizeof(double)*nGrid*(uc->nHKL ? uc->nHKL : 1) );
+  if( !table )
+    return NXS_ERROR_MEMORYALLOCATIONFAILED;
+
+  /* disable any previous table while evaluating */
+  free( md->corrTable );
+  md->corrTable = NULL;
+  md->nCorrGrid = 0;
+
+  for( g=0; g<nGrid; g++ )
+  {
+    double s = (double)g / (double)(nGrid-1);
+    double cos_alpha_h = 1.0 - s*s;
+    double sin_alpha_h = sqrt( 1.0 - cos_alpha_h*cos_alpha_h );
+    for( i=0; i<uc->nHKL; i++ )
+      table[i*nGrid+g] = _textureCorrection( i, cos_alpha_h, sin_alpha_h, md );
+  }
+
+  md->corrTable = table;
+  md->nCorrGrid = nGrid;
+  return NXS_ERROR_OK;
+}
+
+
+/**
+ * \fn double nxs_TextureCorrection( unsigned int ihkl, double lambda, NXS_MarchDollase* md )
+ * \brief March-Dollase correction factor of a given plane (added by NCrystal developers).
+ *
+ * Uses linear interpolation in the table set up by nxs_initTextureTable() if present,
+ * otherwise the full integration is carried out.
+ * @param ihkl index of the plane in the hkl list
+ * @param lambda wavelength in &Aring; (less than 2 d_hkl)
+ * @param md NXS_MarchDollase struct
+ * @return correction factor
+ */
+double nxs_TextureCorrection( unsigned int ihkl, double lambda, NXS_MarchDollase* md )
+{
+  double x = lambda/2.0/md->unitcell->hklList[ihkl].dhkl;
+  if( x>1.0 ) x = 1.0;
+  if( md->corrTable )
+  {
+    const double *row = md->corrTable + ihkl*md->nCorrGrid;
+    double t = sqrt( 1.0 - x ) * (double)(md->nCorrGrid-1);
+    unsigned int g = (unsigned int)t;
+    if( g>=md->nCorrGrid-1 )
+      return row[md->nCorrGrid-1];
+    t -= (double)g;
+    return row[g] + t*( row[g+1] - row[g] );
+  }
+  /* alpha_h = pi/2 - asin(x), so cos(alpha_h)=x and sin(alpha_h)=sqrt(1-x^2) */
+  return _textureCorrection( ihkl, x, sqrt( 1.0 - x*x ), md );
+}
+
+
+/**
+ * \fn void nxs_freeMarchDollase( NXS_MarchDollase* md )
+ * \brief Releases all memory held by a NXS_MarchDollase struct (added by NCrystal developers).
+ *
+ * The unit cell is not touched.
+ * @param md NXS_MarchDollase struct
+ */
+void nxs_freeMarchDollase( NXS_MarchDollase* md )
+{
+  unsigned int i, j;
+  for( j=0; j<md->nOrientations; j++ )
+  {
+    for( i=0; i<md->unitcell->nHKL; i++ )
+    {
+      free( md->texture[j].sin_beta[i] );
+      free( md->texture[j].cos_beta[i] );
+    }
+    free( md->texture[j].sin_beta );
+    free( md->texture[j].cos_beta );
+    free( md->texture[j].P_alpha_H );
+  }
+  free( md->texture );
+  free( md->sin_phi );
+  free( md->cos_phi );
+  free( md->corrTable );
+  md->texture = NULL;
+  md->sin_phi = NULL;
+  md->cos_phi = NULL;
+  md->corrTable = NULL;
+  md->nOrientations = 0;
+  md->nCorrGrid = 0;
+}
+
+
 /* keys for the nxs parameter file */
 const char *NXS_keys[] =
 {
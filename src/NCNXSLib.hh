@@ -1940,6 +1940,7 @@ void Set_uvw(const T_SgInfo *SgInfo, int h, int k, int l, int *uvw);
 #define NXS_ERROR_READINGFILE            -10
 #define NXS_ERROR_SAVINGFILE             -11
 #define NXS_ERROR_MEMORYALLOCATIONFAILED -20
+#define NXS_ERROR_UNSORTEDINPUT          -30/* added by NCrystal developers */
 
 
 const char* nxs_version();
@@ -1977,6 +1978,7 @@ typedef struct NXS_HKL {
   double dhkl;                     /*!< hkl lattice spacing in &Aring;*/
   double FSquare;                  /*!< \f$|F|^2\f$ (structure factor) */
   NXS_EquivHKL *equivHKL;          /*!< holds the symmetry equivalent reflections including the current indices */
+  unsigned int nEquivHKL;          /*!< number of entries in equivHKL (added by NCrystal developers) */
 } NXS_HKL;
 
 
@@ -2009,6 +2011,37 @@ typedef struct NXS_AtomInfo {
 } NXS_AtomInfo;
 
 
+/**
+\struct <NXS_HKLStats>
+
+  \brief timings and counters of the last nxs_initHKLList() call (added by NCrystal developers)
+*/
+typedef struct NXS_HKLStats {
+  unsigned long nCandidates;       /*!< hkl index triplets enumerated */
+  unsigned long nNotSysAbsent;     /*!< candidates which are not systematically absent (excluding 000) */
+  unsigned long nSymEquivTests;    /*!< symmetry equivalence tests between candidates and unique reflections */
+  unsigned long bytesAllocated;    /*!< bytes allocated for the hkl list and the equivalent reflections */
+  double timeEnumerate;            /*!< wall-clock time [s] spent finding unique reflections */
+  double timeEquivHKL;             /*!< wall-clock time [s] spent on multiplicities and equivalent reflections */
+  double timeDhkl;                 /*!< wall-clock time [s] spent on d-spacings */
+  double timeFSquare;              /*!< wall-clock time [s] spent on structure factors */
+  double timeSort;                 /*!< wall-clock time [s] spent sorting by d-spacing */
+} NXS_HKLStats;
+
+
+/**
+\struct <NXS_DebyeFactors>
+
+  \brief temperature dependent factors shared by all atoms with the same Debye temperature, cached by nxs_addAtomInfo() (added by NCrystal developers)
+*/
+typedef struct NXS_DebyeFactors {
+  double x;                        /*!< \f$\theta_D/T\f$ for which the factors below were calculated (0 if not calculated) */
+  double sph_factor;               /*!< single phonon factor R(x) or its asymptotic form */
+  double phi_1;                    /*!< \f$\phi_1(1/x)\f$ */
+  double phi_3;                    /*!< \f$\phi_3(1/x)\f$ */
+} NXS_DebyeFactors;
+
+
 /**
 \struct <NXS_UnitCell>
 
@@ -2035,11 +2068,17 @@ typedef struct NXS_UnitCell {
   T_SgInfo sgInfo;                       /*!< struct from SgInfo library needed for further calculations see SgInfo documentation on http://cci.lbl.gov/sginfo/ */
   double temperature;                    /*!< sample environment temperature [K] */
   double volume;                         /*!< unit cell volume */
+  double recipMetric[6];                 /*!< reciprocal metric tensor as (G*11,G*22,G*33,2G*12,2G*13,2G*23) in [\f$\AA^{-2}\f$], set by nxs_initUnitCell() (added by NCrystal developers) */
   double mass;                           /*!< unit cell mass [\f$\frac{g}{mol}\f$]*/
   double density;                        /*!< unit cell density [\f$\frac{g}{cm^3}\f$]*/
   unsigned int nHKL;                     /*!< number of hkl reflections after initUnitCell() */
   unsigned int maxHKL_index;             /*!< maximum hkl index */
   NXS_HKL *hklList;                      /*!< \see NXS_HKL */
+  double *hklCumFMd;                     /*!< nHKL+1 cumulative sums of FSquare*multiplicity*dhkl over hklList, set by nxs_initHKLList() (added by NCrystal developers) */
+  NXS_HKLStats hklStats;                 /*!< \see NXS_HKLStats (added by NCrystal developers) */
+  NXS_DebyeFactors debyeFactors;         /*!< \see NXS_DebyeFactors (added by NCrystal developers) */
+  void (*calcFSquareList)( NXS_HKL *hkl, unsigned int nHKL, struct NXS_UnitCell *uc, void *data ); /*!< if set, used by nxs_initHKLList() instead of nxs_calcFSquare() to set FSquare of all reflections at once (added by NCrystal developers) */
+  void *calcFSquareListData;             /*!< passed on to calcFSquareList (added by NCrystal developers) */
   unsigned char __flag_mph_c2;           /*!< flag to indicate if mph_c2 is set or should be calculated */
 } NXS_UnitCell;
 
@@ -2047,6 +2086,7 @@ typedef struct NXS_UnitCell {
 NXS_UnitCell nxs_newUnitCell();
 int nxs_initUnitCell( NXS_UnitCell *uc );
 int nxs_addAtomInfo( NXS_UnitCell *uc, NXS_AtomInfo ai );
+void nxs_setTemperature( NXS_UnitCell *uc, double temperature );/* added by NCrystal developers */
 /* nxs_initHKL has a new fix_incoh_xs parameter added by NCrystal developers. If  */
 /* 0, upstream nxslib behaviour is reproduced. If non-zero, incoherent            */
 /* cross-section will not be overestimated in polyatomic materials with large     */
@@ -2054,7 +2094,17 @@ int nxs_addAtomInfo( NXS_UnitCell *uc, NXS_AtomInfo ai );
 /* C. J. Glinka, "Incoherent neutron scattering from multi-element materials",    */
 /* J. Appl. Cryst. (2011). 44, 618-624, https://doi.org/10.1107/S0021889811008223 */
 int nxs_initHKL( NXS_UnitCell *uc, int fix_incoh_xs );
+/* nxs_initHKL is equivalent to calling both of the following functions, which */
+/* were split out by NCrystal developers so the average cross sections needed  */
+/* for non-Bragg cross sections can be set up without enumerating hkl planes.  */
+void nxs_initAverageSigma( NXS_UnitCell *uc, int fix_incoh_xs );
+int nxs_initHKLList( NXS_UnitCell *uc );
 double nxs_calcDhkl( int h, int k, int l, NXS_UnitCell *uc );
+/* nxs_calcInvDhklSq added by NCrystal developers. Evaluates 1/d^2 for n     */
+/* reflections as a quadratic form in the reciprocal metric tensor, without */
+/* any dependency on the crystal system in the loop (so it vectorises).     */
+void nxs_calcInvDhklSq( unsigned int n, const int *h, const int *k, const int *l,
+                        const NXS_UnitCell *uc, double *inv_dsq );
 double nxs_calcFSquare( NXS_HKL *hklReflex, NXS_UnitCell *uc );
 /*****************************************************************************/
 
@@ -2063,6 +2113,10 @@ double nxs_calcFSquare( NXS_HKL *hklReflex, NXS_UnitCell *uc );
 /************************** CROSS SECTION FUNCTIONS **************************/
 double nxs_Absorption             ( double lambda, NXS_UnitCell* uc );
 double nxs_CoherentElastic        ( double lambda, NXS_UnitCell* uc );
+/* nxs_CoherentElasticSweep added by NCrystal developers. Fills xsect with      */
+/* nxs_CoherentElastic at each of n wavelengths, which must be in ascending    */
+/* order, in a single O(n+nHKL) sweep over the sorted plane list.              */
+int nxs_CoherentElasticSweep( unsigned int n, const double *lambda, NXS_UnitCell* uc, double *xsect );
 double nxs_CoherentInelastic      ( double lambda, NXS_UnitCell* uc );
 double nxs_TotalInelastic         ( double lambda, NXS_UnitCell* uc );
 double nxs_TotalInelastic_BINDER  ( double lambda, NXS_UnitCell* uc );
@@ -2111,11 +2165,22 @@ typedef struct NXS_MarchDollase {
   double *cos_phi;
   NXS_Texture *texture;
   NXS_UnitCell *unitcell;
+  unsigned int nCorrGrid;  /*!< number of grid points per plane in corrTable (added by NCrystal developers) */
+  double *corrTable;       /*!< tabulated texture corrections, see nxs_initTextureTable() (added by NCrystal developers) */
 } NXS_MarchDollase;
 
 NXS_MarchDollase nxs_initMarchDollase( NXS_UnitCell* uc );
 void nxs_addTexture( NXS_MarchDollase* md, NXS_Texture texture );
 double nxs_CoherentElasticTexture( double lambda, NXS_MarchDollase* md );
+/* The following were added by NCrystal developers. nxs_initTextureTable      */
+/* tabulates the texture correction factor of each plane on nGrid points in   */
+/* s=sqrt(1-lambda/(2*d_hkl)), after which nxs_CoherentElasticTexture and      */
+/* nxs_TextureCorrection interpolate in the table rather than integrating     */
+/* over all orientations, equivalent planes and azimuth angles at each call.  */
+/* The table must be rebuilt if textures are added afterwards.                */
+int nxs_initTextureTable( NXS_MarchDollase* md, unsigned int nGrid );
+double nxs_TextureCorrection( unsigned int ihkl, double lambda, NXS_MarchDollase* md );
+void nxs_freeMarchDollase( NXS_MarchDollase* md );
 /*****************************************************************************/
 
 
@@ -0,0 +1,147 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCNXSLoadStats.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+namespace NC = NCrystal;
+
+namespace NCPluginNamespace {
+  namespace {
+    struct LoadStatsDB {
+      std::mutex mtx;
+      std::deque<NXSLoadStats> records;
+    };
+    LoadStatsDB& loadStatsDB()
+    {
+      static LoadStatsDB s_db;
+      return s_db;
+    }
+    constexpr std::size_t loadStatsMaxRecords = 1000;
+
+    void streamJSONStr( std::ostream& os, const std::string& s )
+    {
+      os << '"';
+      for ( char c : s ) {
+        switch ( c ) {
+        case '"': os << "\\\""; break;
+        case '\\': os << "\\\\"; break;
+        case '\n': os << "\\n"; break;
+        case '\t': os << "\\t"; break;
+        case '\r': os << "\\r"; break;
+        default:
+          if ( static_cast<unsigned char>(c) < 0x20 ) {
+            char buf[8];
+            std::snprintf( buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(c) );
+            os << buf;
+          } else {
+            os << c;
+          }
+        }
+      }
+      os << '"';
+    }
+  }
+}
+
+std::string NCP::NXSLoadStats::toJSON() const
+{
+  std::ostringstream os;
+  os.precision(17);
+  os << "{\"kind\":";
+  streamJSONStr( os, kind );
+  os << ",\"dataSourceName\":";
+  streamJSONStr( os, dataSourceName );
+  os << ",\"temperature\":" << temperature
+     << ",\"dcutoff\":" << dcutoff
+     << ",\"dcutoffup\":" << dcutoffup
+     << ",\"maxhkl\":" << maxhkl
+     << ",\"timeParse\":" << timeParse
+     << ",\"timeUnitCell\":" << timeUnitCell
+     << ",\"timeAtoms\":" << timeAtoms
+     << ",\"timeTotal\":" << timeTotal
+     << ",\"nAtomSites\":" << nAtomSites
+     << ",\"nAtoms\":" << nAtoms
+     << ",\"fromCache\":" << ( fromCache ? "true" : "false" )
+     << ",\"timeHKLEnumerate\":" << timeHKLEnumerate
+     << ",\"timeHKLEquiv\":" << timeHKLEquiv
+     << ",\"timeHKLDspacing\":" << timeHKLDspacing
+     << ",\"timeHKLFSquare\":" << timeHKLFSquare
+     << ",\"timeHKLSort\":" << timeHKLSort
+     << ",\"timeHKLConvert\":" << timeHKLConvert
+     << ",\"nHKLCandidates\":" << nHKLCandidates
+     << ",\"nHKLNotSysAbsent\":" << nHKLNotSysAbsent
+     << ",\"nHKLSymEquivTests\":" << nHKLSymEquivTests
+     << ",\"nHKLUnique\":" << nHKLUnique
+     << ",\"nHKLKept\":" << nHKLKept
+     << ",\"nHKLEmitted\":" << nHKLEmitted
+     << ",\"bytesAllocated\":" << bytesAllocated
+     << '}';
+  return os.str();
+}
+
+std::vector<NCP::NXSLoadStats> NCP::getLoadStats()
+{
+  auto& db = loadStatsDB();
+  NCRYSTAL_LOCK_GUARD(db.mtx);
+  return std::vector<NXSLoadStats>( db.records.begin(), db.records.end() );
+}
+
+void NCP::clearLoadStats()
+{
+  auto& db = loadStatsDB();
+  NCRYSTAL_LOCK_GUARD(db.mtx);
+  db.records.clear();
+}
+
+std::string NCP::loadStatsToJSON()
+{
+  std::ostringstream os;
+  os << '[';
+  bool first = true;
+  for ( auto& e : getLoadStats() ) {
+    if ( !first )
+      os << ',';
+    first = false;
+    os << e.toJSON();
+  }
+  os << ']';
+  return os.str();
+}
+
+void NCP::registerLoadStats( NXSLoadStats&& stats )
+{
+  const char * statsfile = std::getenv("NCRYSTAL_NXSLIB_STATSFILE");
+  auto& db = loadStatsDB();
+  NCRYSTAL_LOCK_GUARD(db.mtx);
+  if ( statsfile && statsfile[0] ) {
+    std::ofstream ofs( statsfile, std::ios::app );
+    if ( ofs )
+      ofs << stats.toJSON() << '\n';
+  }
+  db.records.push_back( std::move(stats) );
+  while ( db.records.size() > loadStatsMaxRecords )
+    db.records.pop_front();
+}
@@ -0,0 +1,109 @@
+#ifndef NCPlugin_NXSLoadStats_hh
+#define NCPlugin_NXSLoadStats_hh
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCrystal/NCPluginBoilerplate.hh"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace NCPluginNamespace {
+
+  //Timings and counters of the stages of loading .nxs data. A record is made
+  //each time loadNXSCrystal is invoked (kind="info"), and each time the
+  //(deferred) hkl planes are actually produced (kind="hkl"). All times are
+  //wall-clock durations in seconds. Fields not relevant for a given kind are
+  //left at zero.
+  //
+  //The plugin is loaded as a module without installed headers, so the
+  //functions below are only available to code compiled together with the
+  //plugin sources (the plugin tests and nxslib_bench). Applications get the
+  //records through NCRYSTAL_NXSLIB_STATSFILE instead.
+
+  struct NXSLoadStats {
+    std::string kind;
+    std::string dataSourceName;
+    double temperature = 0.0;
+    double dcutoff = 0.0;
+    double dcutoffup = 0.0;
+    unsigned maxhkl = 0;
+
+    //kind="info":
+    double timeParse = 0.0;       //parseNXSData
+    double timeUnitCell = 0.0;    //nxs_initUnitCell (space group setup incl. CompleteSgInfo)
+    double timeAtoms = 0.0;       //nxs_addAtomInfo (Wyckoff expansion)
+    double timeTotal = 0.0;       //everything in the stage
+    std::uint64_t nAtomSites = 0; //add_atom entries
+    std::uint64_t nAtoms = 0;     //atoms in unit cell after Wyckoff expansion
+
+    //kind="hkl":
+    bool fromCache = false;       //hkl list was taken from NCRYSTAL_NXSLIB_CACHEDIR
+    double timeHKLEnumerate = 0.0;
+    double timeHKLEquiv = 0.0;
+    double timeHKLDspacing = 0.0;
+    double timeHKLFSquare = 0.0;
+    double timeHKLSort = 0.0;
+    double timeHKLConvert = 0.0;  //cuts and conversion to NCrystal::HKLList
+    std::uint64_t nHKLCandidates = 0;
+    std::uint64_t nHKLNotSysAbsent = 0;
+    std::uint64_t nHKLSymEquivTests = 0;
+    std::uint64_t nHKLUnique = 0;
+    std::uint64_t nHKLKept = 0;   //after d-spacing and |F|^2 cuts
+    std::uint64_t nHKLEmitted = 0;//after optional post-processing (see NCNXSHKLTools.hh)
+    std::uint64_t bytesAllocated = 0;
+
+    //Single-line JSON object with all fields:
+    std::string toJSON() const;
+  };
+
+  //Records from the most recent loads (oldest first, at most 1000 kept):
+  std::vector<NXSLoadStats> getLoadStats();
+  void clearLoadStats();
+
+  //JSON array of all records from getLoadStats():
+  std::string loadStatsToJSON();
+
+  //Register a new record. If the environment variable
+  //NCRYSTAL_NXSLIB_STATSFILE is set, the record is also appended (as a line of
+  //JSON) to the file it points to.
+  void registerLoadStats( NXSLoadStats&& );
+
+  class StageTimer {
+  public:
+    //Measure wall-clock time since construction or last call to lap().
+    StageTimer() : m_t0(std::chrono::steady_clock::now()) {}
+    double lap()
+    {
+      auto t = std::chrono::steady_clock::now();
+      double res = std::chrono::duration<double>( t - m_t0 ).count();
+      m_t0 = t;
+      return res;
+    }
+  private:
+    std::chrono::steady_clock::time_point m_t0;
+  };
+
+}
+
+#endif
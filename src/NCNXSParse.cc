@@ -0,0 +1,212 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCNXSParse.hh"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#if __has_include(<version>)
+#  include <version>
+#endif
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#  include <charconv>
+#  define NCPLUGIN_NXSPARSE_FROMCHARS
+#endif
+
+namespace NC = NCrystal;
+
+namespace NCPluginNamespace {
+  namespace {
+
+    using StrView = std::string_view;
+
+    //Same classification as isspace in the C locale, which nxslib uses:
+    inline bool isSpace( char c )
+    {
+      return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+
+    inline StrView trimmed( StrView s )
+    {
+      while ( !s.empty() && isSpace( s.front() ) )
+        s.remove_prefix(1);
+      while ( !s.empty() && isSpace( s.back() ) )
+        s.remove_suffix(1);
+      return s;
+    }
+
+    //Same as strtod on the (NUL-terminated) value, i.e. parses the longest
+    //valid prefix and gives 0.0 if there is none:
+    double parseDbl( StrView s )
+    {
+#ifdef NCPLUGIN_NXSPARSE_FROMCHARS
+      double v;
+      auto res = std::from_chars( s.data(), s.data() + s.size(), v );
+      if ( res.ec == std::errc() && ( res.ptr == s.data() + s.size() || ( *res.ptr != 'x' && *res.ptr != 'X' ) ) )
+        return v;
+#endif
+      //Leading '+', hex numbers, out of range values, ... are rare, so simply
+      //fall back to strtod on a copy:
+      std::string tmp( s );
+      return std::strtod( tmp.c_str(), nullptr );
+    }
+
+    inline void copyStr( StrView s, char * dest, std::size_t destsize )
+    {
+      //As strncpy(dest,src,destsize-1), leaving the last byte untouched:
+      const std::size_t n = std::min( s.size(), destsize - 1 );
+      std::memcpy( dest, s.data(), n );
+      std::memset( dest + n, 0, destsize - 1 - n );
+    }
+
+    enum class Key { Unknown, SpaceGroup, LatticeA, LatticeB, LatticeC,
+                     LatticeAlpha, LatticeBeta, LatticeGamma, AddAtom, MphC2, DebyeTemp };
+
+    Key lookupKey( StrView k )
+    {
+      //Dispatch on length, so at most two string comparisons are needed:
+      switch ( k.size() ) {
+      case 6: return k == "mph_c2" ? Key::MphC2 : Key::Unknown;
+      case 8: return k == "add_atom" ? Key::AddAtom : Key::Unknown;
+      case 9:
+        if ( k.compare( 0, 8, "lattice_" ) != 0 )
+          return Key::Unknown;
+        switch ( k[8] ) {
+        case 'a': return Key::LatticeA;
+        case 'b': return Key::LatticeB;
+        case 'c': return Key::LatticeC;
+        default: return Key::Unknown;
+        }
+      case 10: return k == "debye_temp" ? Key::DebyeTemp : Key::Unknown;
+      case 11: return k == "space_group" ? Key::SpaceGroup : Key::Unknown;
+      case 12: return k == "lattice_beta" ? Key::LatticeBeta : Key::Unknown;
+      case 13:
+        if ( k == "lattice_alpha" )
+          return Key::LatticeAlpha;
+        return k == "lattice_gamma" ? Key::LatticeGamma : Key::Unknown;
+      default:
+        return Key::Unknown;
+      }
+    }
+  }
+}
+
+void NCP::NXSAtomSite::fill( nxs::NXS_AtomInfo& ai ) const
+{
+  copyStr( label, ai.label, sizeof(ai.label) );
+  ai.b_coherent = b_coherent;
+  ai.sigmaIncoherent = sigmaIncoherent;
+  ai.sigmaAbsorption = sigmaAbsorption;
+  ai.molarMass = molarMass;
+  ai.debyeTemp = debyeTemp;
+  ai.x[0] = x;
+  ai.y[0] = y;
+  ai.z[0] = z;
+}
+
+std::vector<NCP::NXSAtomSite> NCP::parseNXSData( const NC::TextData& textData, nxs::NXS_UnitCell& uc )
+{
+  uc = nxs::nxs_newUnitCell();
+  std::vector<NXSAtomSite> atoms;
+  const auto& dataDescr = textData.dataSourceName();
+  unsigned lineno = 0;
+
+  for ( const std::string& linestr : textData ) {
+    ++lineno;
+    //The tokenisation mirrors the strtok calls of nxs_readParameterFile. The
+    //key is the text up to the first '=' (leading '=' characters skipped):
+    StrView line( linestr );
+    while ( !line.empty() && isSpace( line.front() ) )
+      line.remove_prefix(1);
+    while ( !line.empty() && line.front() == '=' )
+      line.remove_prefix(1);
+    if ( line.empty() )
+      continue;
+    const auto ieq = line.find('=');
+    StrView keystr = line.substr( 0, ieq );
+    while ( !keystr.empty() && isSpace( keystr.back() ) )
+      keystr.remove_suffix(1);
+    const Key key = lookupKey( keystr );
+    if ( key == Key::Unknown )
+      continue;
+
+    //The value is the next text not containing any of "=#!;" (again skipping
+    //leading delimiters). Unlike nxslib, we do not crash if there is no '=':
+    if ( ieq == StrView::npos )
+      NCRYSTAL_THROW2(DataLoadError,"Missing value of \""<<keystr<<"\" in line "<<lineno<<" of data: "<<dataDescr);
+    StrView value = line.substr( ieq + 1 );
+    value = value.substr( std::min( value.size(), value.find_first_not_of( "=#!;" ) ) );
+    value = trimmed( value.substr( 0, value.find_first_of( "=#!;" ) ) );
+
+    switch ( key ) {
+    case Key::SpaceGroup: copyStr( value, uc.spaceGroup, sizeof(uc.spaceGroup) ); break;
+    case Key::LatticeA: uc.a = parseDbl( value ); break;
+    case Key::LatticeB: uc.b = parseDbl( value ); break;
+    case Key::LatticeC: uc.c = parseDbl( value ); break;
+    case Key::LatticeAlpha: uc.alpha = parseDbl( value ); break;
+    case Key::LatticeBeta: uc.beta = parseDbl( value ); break;
+    case Key::LatticeGamma: uc.gamma = parseDbl( value ); break;
+    case Key::MphC2: uc.mph_c2 = parseDbl( value ); break;
+    case Key::DebyeTemp: uc.debyeTemp = parseDbl( value ); break;
+    case Key::AddAtom:
+      {
+        //"label b_coh sigma_inc sigma_abs molar_mass [debye_temp] x y z":
+        StrView words[9];
+        unsigned nwords = 0;
+        for ( std::size_t i = 0; i < value.size(); ) {
+          while ( i < value.size() && isSpace( value[i] ) )
+            ++i;
+          if ( i == value.size() )
+            break;
+          const std::size_t iword = i;
+          while ( i < value.size() && !isSpace( value[i] ) )
+            ++i;
+          if ( nwords < 9 )
+            words[nwords] = value.substr( iword, i - iword );
+          ++nwords;
+        }
+        if ( nwords < 8 )
+          NCRYSTAL_THROW2(DataLoadError,"Too few parameters of add_atom in line "<<lineno<<" of data: "<<dataDescr);
+        NXSAtomSite site;
+        site.label.assign( words[0].data(), words[0].size() );
+        site.b_coherent = parseDbl( words[1] );
+        site.sigmaIncoherent = parseDbl( words[2] );
+        site.sigmaAbsorption = parseDbl( words[3] );
+        site.molarMass = parseDbl( words[4] );
+        //For compatibility with earlier versions of nxs, the atom specific
+        //Debye temperature is optional:
+        const unsigned ixyz = ( nwords > 8 ? 6 : 5 );
+        site.debyeTemp = ( nwords > 8 ? parseDbl( words[5] ) : -1.0 );
+        site.x = parseDbl( words[ixyz] );
+        site.y = parseDbl( words[ixyz+1] );
+        site.z = parseDbl( words[ixyz+2] );
+        atoms.push_back( std::move(site) );
+      }
+      break;
+    case Key::Unknown:
+      break;
+    }
+  }
+
+  if ( atoms.empty() )
+    NCRYSTAL_THROW2(DataLoadError,"Could not read crystal information from data: "<<dataDescr);
+  return atoms;
+}
@@ -0,0 +1,49 @@
+#ifndef NCPlugin_NXSParse_hh
+#define NCPlugin_NXSParse_hh
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCrystal/NCPluginBoilerplate.hh"
+#include "NCNXSLib.hh"
+
+namespace NCPluginNamespace {
+
+  //Parameters of an add_atom entry (NXS_AtomInfo is much larger, since it
+  //also holds the positions of all equivalent sites):
+  struct NXSAtomSite {
+    std::string label;
+    double b_coherent, sigmaIncoherent, sigmaAbsorption, molarMass;
+    double debyeTemp;//-1.0 if not given
+    double x, y, z;
+    //Set the corresponding fields of ai, leaving the others untouched:
+    void fill( nxs::NXS_AtomInfo& ai ) const;
+  };
+
+  //Parses .nxs data directly from the lines of the TextData object, with the
+  //same results as nxs_readParameterFile (the unit cell is reset with
+  //nxs_newUnitCell, and the add_atom entries are returned for use with
+  //nxs_addAtomInfo), but without copying lines or limiting their length.
+  //Throws DataLoadError on syntax errors or if no atoms are specified.
+  std::vector<NXSAtomSite> parseNXSData( const NC::TextData&, nxs::NXS_UnitCell& );
+
+}
+
+#endif
@@ -0,0 +1,41 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCNXSRegistry.hh"
+#include "NCrystal/internal/utils/NCString.hh"
+
+namespace NC = NCrystal;
+
+NC::VectS NCP::registryIdLine( std::uint64_t id )
+{
+  return { "id", std::to_string( id ) };
+}
+
+std::uint64_t NCP::registryIdFromInfo( const NC::Info& info, const std::string& sectionname )
+{
+  if ( !info.countCustomSections( sectionname ) )
+    NCRYSTAL_THROW2(BadInput,"Material has no "<<sectionname<<" section");
+  const auto& section = info.getCustomSection( sectionname );
+  int id = 0;
+  if ( section.empty() || section.front().size() != 2 || section.front().front() != "id"
+       || !NC::safe_str2int( section.front().back(), id ) || id <= 0 )
+    NCRYSTAL_THROW2(BadInput,sectionname<<" section not produced by " NCPLUGIN_NAME_CSTR " plugin");
+  return static_cast<std::uint64_t>( id );
+}
@@ -0,0 +1,73 @@
+#ifndef NCPlugin_NXSRegistry_hh
+#define NCPlugin_NXSRegistry_hh
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCrystal/NCPluginBoilerplate.hh"
+#include <map>
+#include <mutex>
+
+namespace NCPluginNamespace {
+
+  //Objects created when loading a material, which must be found again by the
+  //plugin's scatter factories. The Info object keeps them alive (via its
+  //background cross section provider), and refers to them by an id in one of
+  //its custom sections. The registry itself only holds weak references.
+  template<class T>
+  class SharedObjectRegistry final : private NC::NoCopyMove {
+  public:
+    std::uint64_t add( std::shared_ptr<const T> obj )
+    {
+      NCRYSTAL_LOCK_GUARD(m_mtx);
+      //Forget expired entries:
+      for ( auto it = m_objects.begin(); it != m_objects.end(); ) {
+        if ( it->second.expired() )
+          it = m_objects.erase(it);
+        else
+          ++it;
+      }
+      const std::uint64_t id = m_nextid++;
+      m_objects[id] = obj;
+      return id;
+    }
+
+    //Returns nullptr if no such object is alive:
+    std::shared_ptr<const T> find( std::uint64_t id ) const
+    {
+      NCRYSTAL_LOCK_GUARD(m_mtx);
+      auto it = m_objects.find(id);
+      return it == m_objects.end() ? nullptr : it->second.lock();
+    }
+
+  private:
+    mutable std::mutex m_mtx;
+    std::uint64_t m_nextid = 1;
+    std::map<std::uint64_t,std::weak_ptr<const T>> m_objects;
+  };
+
+  //First line of the custom sections referring to registered objects:
+  NC::VectS registryIdLine( std::uint64_t id );
+  //Id from a custom section of an Info object (throws if absent or invalid):
+  std::uint64_t registryIdFromInfo( const NC::Info&, const std::string& sectionname );
+
+}
+
+#endif
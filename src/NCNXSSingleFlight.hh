@@ -0,0 +1,84 @@
+#ifndef NCPlugin_NXSSingleFlight_hh
+#define NCPlugin_NXSSingleFlight_hh
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCrystal/NCPluginBoilerplate.hh"
+#include <future>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+namespace NCPluginNamespace {
+
+  //Used by PluginFactory::produce to avoid duplicate concurrent loads:
+  class SingleFlightLoads final : private NC::NoCopyMove {
+    //When several threads request the same data with the same parameters at
+    //the same time (before NCrystal's own Info cache has been filled), only
+    //the first thread performs the load, while the others wait for and share
+    //its result (or exception).
+  public:
+    //Key is (data UID, temperature, dcutoff, dcutoffup):
+    using Key = std::tuple<std::uint64_t,double,double,double>;
+
+    template<class TFct>
+    NC::InfoPtr getOrProduce( const Key& key, TFct&& fct )
+    {
+      std::promise<NC::InfoPtr> promise;
+      std::shared_future<NC::InfoPtr> fut;
+      {
+        NCRYSTAL_LOCK_GUARD(m_mtx);
+        auto it = m_inflight.find(key);
+        if ( it != m_inflight.end() ) {
+          fut = it->second;
+        } else {
+          m_inflight[key] = promise.get_future().share();
+        }
+      }
+      if ( fut.valid() )
+        return fut.get();//Another thread is doing the work.
+
+      NC::InfoPtr result;
+      try {
+        result = fct();
+      } catch (...) {
+        promise.set_exception( std::current_exception() );
+        finish(key);
+        throw;
+      }
+      promise.set_value( result );
+      finish(key);
+      return result;
+    }
+
+  private:
+    void finish( const Key& key )
+    {
+      NCRYSTAL_LOCK_GUARD(m_mtx);
+      m_inflight.erase(key);
+    }
+    std::mutex m_mtx;
+    std::map<Key,std::shared_future<NC::InfoPtr>> m_inflight;
+  };
+
+}
+
+#endif
@@ -0,0 +1,188 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCNXSTexture.hh"
+#include "NCFactory_NXS.hh"
+#include "NCrystal/internal/utils/NCString.hh"
+#include <cmath>
+#include <cstring>
+
+namespace NC = NCrystal;
+
+std::vector<NCP::NXSTextureParams> NCP::parseNXSTextures( const NC::TextData& textData )
+{
+  std::vector<NXSTextureParams> res;
+  for ( const std::string& value : nxsKeyValues( textData, "texture" ) ) {
+    auto words = NC::split2( value );
+    NXSTextureParams t;
+    if ( words.size() != 5
+         || !NC::safe_str2int( words.at(0), t.a )
+         || !NC::safe_str2int( words.at(1), t.b )
+         || !NC::safe_str2int( words.at(2), t.c )
+         || !NC::safe_str2dbl( words.at(3), t.r )
+         || !NC::safe_str2dbl( words.at(4), t.f ) )
+      NCRYSTAL_THROW2(DataLoadError,"Invalid texture specification (expected \"texture = a b c r f\")"
+                      " in data "<<textData.dataSourceName()<<": \"texture ="<<value<<"\"");
+    if ( ( t.a == 0 && t.b == 0 && t.c == 0 ) || !(t.r > 0.0) || !(t.f >= 0.0) )
+      NCRYSTAL_THROW2(DataLoadError,"Invalid texture parameters (need non-zero (a,b,c), r>0 and f>=0)"
+                      " in data "<<textData.dataSourceName()<<": \"texture ="<<value<<"\"");
+    res.push_back( t );
+  }
+  return res;
+}
+
+NCP::NXSTextureModel::NXSTextureModel( const nxs::NXS_UnitCell& nxs_uc,
+                                       const std::vector<NXSTextureParams>& textures,
+                                       NC::PairDD dspacingRange,
+                                       unsigned ngrid )
+  : m_ngrid( std::max<unsigned>( 2, ngrid ) ),
+    m_xsfact( 1e-2 / ( 2.0 * nxs_uc.volume * nxs_uc.nAtoms ) ),
+    m_dmax( 0.0 )
+{
+  //The nxslib functions only read the unit cell, but take non-const pointers:
+  nxs::NXS_UnitCell* ucpar = const_cast<nxs::NXS_UnitCell*>(&nxs_uc);
+  nxs::NXS_MarchDollase md = nxs::nxs_initMarchDollase( ucpar );
+  struct Guard {
+    nxs::NXS_MarchDollase& md;
+    ~Guard() { nxs::nxs_freeMarchDollase( &md ); }
+  } guard{md};
+  for ( auto& t : textures ) {
+    nxs::NXS_Texture texture;
+    std::memset( &texture, 0, sizeof(texture) );
+    texture.a = t.a;
+    texture.b = t.b;
+    texture.c = t.c;
+    texture.r = t.r;
+    texture.f = t.f;
+    nxs::nxs_addTexture( &md, texture );
+  }
+  if ( NXS_ERROR_OK != nxs::nxs_initTextureTable( &md, m_ngrid ) )
+    NCRYSTAL_THROW(CalcError,"Could not tabulate texture corrections");
+
+  //Keep what is needed of the selected planes:
+  for ( unsigned i = 0; i < nxs_uc.nHKL; ++i ) {
+    const auto& hkl = nxs_uc.hklList[i];
+    if ( hkl.dhkl < dspacingRange.first || hkl.dhkl > dspacingRange.second )
+      continue;
+    m_dhkl.push_back( hkl.dhkl );
+    m_fmd.push_back( hkl.FSquare * hkl.multiplicity * hkl.dhkl );
+    m_corr.insert( m_corr.end(), md.corrTable + i * m_ngrid, md.corrTable + ( i + 1 ) * m_ngrid );
+    m_dmax = std::max( m_dmax, hkl.dhkl );
+  }
+}
+
+template<class TFct>
+double NCP::NXSTextureModel::sumContributions( double lambda, TFct&& fct ) const
+{
+  //Same as nxs_CoherentElasticTexture/nxs_TextureCorrection with a texture
+  //table, calling fct(iplane,sum) after adding each contribution (stops if it
+  //returns true):
+  double sum = 0.0;
+  const double nm1 = m_ngrid - 1;
+  for ( std::size_t i = 0; i < m_dhkl.size(); ++i ) {
+    if ( !( lambda - 2.0 * m_dhkl[i] < -1e-6 ) )
+      continue;
+    const double x = lambda / ( 2.0 * m_dhkl[i] );
+    double t = std::sqrt( 1.0 - x ) * nm1;
+    const double * row = &m_corr[ i * m_ngrid ];
+    unsigned g = static_cast<unsigned>( t );
+    double corr;
+    if ( g >= m_ngrid - 1 ) {
+      corr = row[m_ngrid-1];
+    } else {
+      t -= g;
+      corr = row[g] + t * ( row[g+1] - row[g] );
+    }
+    sum += m_fmd[i] * corr;
+    if ( fct( i, sum ) )
+      break;
+  }
+  return sum;
+}
+
+NC::CrossSect NCP::NXSTextureModel::crossSection( NC::NeutronWavelength wl ) const
+{
+  const double lambda = wl.dbl();
+  if ( !( lambda < 2.0 * m_dmax ) )
+    return NC::CrossSect{ 0.0 };
+  const double sum = sumContributions( lambda, []( std::size_t, double ) { return false; } );
+  return NC::CrossSect{ std::max( 0.0, sum * m_xsfact * lambda * lambda ) };
+}
+
+NC::CosineScatAngle NCP::NXSTextureModel::sampleMu( NC::RNG& rng, NC::NeutronWavelength wl ) const
+{
+  const double lambda = wl.dbl();
+  const double total = sumContributions( lambda, []( std::size_t, double ) { return false; } );
+  if ( !( total > 0.0 ) )
+    return NC::CosineScatAngle{ 1.0 };
+  const double target = rng.generate() * total;
+  std::size_t iplane = m_dhkl.size();
+  sumContributions( lambda, [target,&iplane]( std::size_t i, double sum )
+  {
+    iplane = i;
+    return sum >= target;
+  } );
+  nc_assert( iplane < m_dhkl.size() );
+  //Scattering angle 2*theta, with sin(theta)=lambda/(2*d):
+  const double x = lambda / ( 2.0 * m_dhkl[iplane] );
+  return NC::CosineScatAngle{ std::max( -1.0, std::min( 1.0, 1.0 - 2.0 * x * x ) ) };
+}
+
+NCP::SharedObjectRegistry<NCP::NXSTextureSource>& NCP::textureSourceRegistry()
+{
+  static SharedObjectRegistry<NXSTextureSource> s_reg;
+  return s_reg;
+}
+
+NCP::NXSTextureSource::NXSTextureSource( Producer producer )
+  : m_producer(std::move(producer))
+{
+}
+
+std::shared_ptr<const NCP::NXSTextureModel> NCP::NXSTextureSource::model() const
+{
+  NCRYSTAL_LOCK_GUARD(m_mtx);
+  if ( !m_model )
+    m_model = m_producer();
+  return m_model;
+}
+
+NCP::NXSTexturedBragg::NXSTexturedBragg( std::shared_ptr<const NXSTextureModel> model )
+  : m_model( std::move(model) )
+{
+  nc_assert_always( !!m_model );
+}
+
+NC::EnergyDomain NCP::NXSTexturedBragg::domain() const noexcept
+{
+  return { m_model->braggThreshold().energy(), NC::NeutronEnergy{ NC::kInfinity } };
+}
+
+NC::CrossSect NCP::NXSTexturedBragg::crossSectionIsotropic( NC::CachePtr&, NC::NeutronEnergy ekin ) const
+{
+  return m_model->crossSection( ekin.wavelength() );
+}
+
+NC::ScatterOutcomeIsotropic NCP::NXSTexturedBragg::sampleScatterIsotropic( NC::CachePtr&,
+                                                                           NC::RNG& rng,
+                                                                           NC::NeutronEnergy ekin ) const
+{
+  return { ekin, m_model->sampleMu( rng, ekin.wavelength() ) };
+}
@@ -0,0 +1,103 @@
+#ifndef NCPlugin_NXSTexture_hh
+#define NCPlugin_NXSTexture_hh
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of NCrystal (see https://mctools.github.io/ncrystal/)   //
+//                                                                            //
+//  Copyright 2015-2024 NCrystal developers                                   //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "NCrystal/NCPluginBoilerplate.hh"
+#include "NCNXSLib.hh"
+#include "NCNXSRegistry.hh"
+#include <functional>
+
+namespace NCPluginNamespace {
+
+  //March-Dollase texture of a sample, specified in .nxs data by lines like
+  //"texture = a b c r f" (one per preferred orientation (a,b,c), with
+  //March-Dollase parameter r and weight f). These lines are ignored by nxslib
+  //itself, but are picked up by the plugin which then provides Bragg
+  //diffraction as calculated by nxs_CoherentElasticTexture.
+  struct NXSTextureParams {
+    int a, b, c;
+    double r, f;
+  };
+  std::vector<NXSTextureParams> parseNXSTextures( const NC::TextData& );
+
+  //Bragg diffraction of a textured powder. The texture correction factors of
+  //all planes are tabulated once (with nxs_initTextureTable), so each cross
+  //section evaluation is a single pass over the planes, interpolating in the
+  //table. Scattering angles are sampled by picking a plane according to its
+  //contribution to the cross section.
+  class NXSTextureModel final : private NC::NoCopyMove {
+  public:
+    //Unit cell must have an initialised hkl list (including equivalent planes),
+    //which is only read. Planes outside the dspacing range are ignored:
+    NXSTextureModel( const nxs::NXS_UnitCell&,
+                     const std::vector<NXSTextureParams>&,
+                     NC::PairDD dspacingRange,
+                     unsigned ngrid = 128 );
+
+    //Cross section per atom:
+    NC::CrossSect crossSection( NC::NeutronWavelength ) const;
+    NC::CosineScatAngle sampleMu( NC::RNG&, NC::NeutronWavelength ) const;
+
+    //Longest wavelength with non-zero cross section:
+    NC::NeutronWavelength braggThreshold() const { return NC::NeutronWavelength{ m_dmax * 2.0 }; }
+
+  private:
+    template<class TFct>
+    double sumContributions( double lambda, TFct&& ) const;
+    std::vector<double> m_dhkl;//sorted by decreasing d-spacing
+    std::vector<double> m_fmd;//FSquare*multiplicity*dhkl
+    std::vector<double> m_corr;//[iplane*m_ngrid+igrid], see nxs_initTextureTable
+    unsigned m_ngrid;
+    double m_xsfact;
+    double m_dmax;
+  };
+
+  //The model of a given material is only created if needed for scattering
+  //(and then only once). The Info object keeps its source alive, and refers
+  //to it by its id in textureSourceRegistry() in its NXSTEXTURE custom
+  //section, so the scatter factory can find it:
+  class NXSTextureSource final : private NC::NoCopyMove {
+  public:
+    using Producer = std::function<std::shared_ptr<const NXSTextureModel>()>;
+    NXSTextureSource( Producer );
+    std::shared_ptr<const NXSTextureModel> model() const;
+  private:
+    Producer m_producer;
+    mutable std::mutex m_mtx;
+    mutable std::shared_ptr<const NXSTextureModel> m_model;
+  };
+  SharedObjectRegistry<NXSTextureSource>& textureSourceRegistry();
+
+  class NXSTexturedBragg final : public NC::ProcImpl::ScatterIsotropicMat {
+  public:
+    NXSTexturedBragg( std::shared_ptr<const NXSTextureModel> );
+    const char * name() const noexcept override { return NCPLUGIN_NAME_CSTR "TexturedBragg"; }
+    NC::EnergyDomain domain() const noexcept override;
+    NC::CrossSect crossSectionIsotropic( NC::CachePtr&, NC::NeutronEnergy ) const override;
+    NC::ScatterOutcomeIsotropic sampleScatterIsotropic( NC::CachePtr&, NC::RNG&, NC::NeutronEnergy ) const override;
+  private:
+    std::shared_ptr<const NXSTextureModel> m_model;
+  };
+
+}
+
+#endif
@@ -16,6 +16,8 @@ void NCP::registerPlugin()
   //factories, a potentially other stuff as appropriate for the plugin (like
   //adding in-mem data files, adding test functions, ...).
   NC::FactImpl::registerFactory(std::make_unique<NCP::PluginFactory>());
+  NC::FactImpl::registerFactory(std::make_unique<NCP::TextureFactory>());
+  NC::FactImpl::registerFactory(std::make_unique<NCP::BkgdFactory>());
   NC::Plugins::registerPluginTestFunction( std::string("test_") + pluginName(),
                                            customPluginTest );
   NC::DataSources::addRecognisedFileExtensions("nxs");
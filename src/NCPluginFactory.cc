@@ -1,8 +1,22 @@
 #include "NCPluginFactory.hh"
 #include "NCrystal/internal/utils/NCString.hh"
 #include "NCFactory_NXS.hh"
+#include "NCNXSTexture.hh"
+#include "NCNXSBkgdScatter.hh"
+#include "NCNXSBatchLoad.hh"
+#include "NCNXSSingleFlight.hh"
 #include <iostream>
 
+namespace NCPluginNamespace {
+  namespace {
+    SingleFlightLoads& singleFlightLoads()
+    {
+      static SingleFlightLoads s_sfl;
+      return s_sfl;
+    }
+  }
+}
+
 const char * NCP::PluginFactory::name() const noexcept
 {
   return NCPLUGIN_NAME_CSTR "Factory";
@@ -16,12 +30,76 @@ NC::Priority NCP::PluginFactory::query( const NC::FactImpl::InfoRequest& cfg ) c
 NC::InfoPtr NCP::PluginFactory::produce( const NC::FactImpl::InfoRequest& cfg ) const
 {
   nc_assert_always( cfg.getDataType()=="nxs" );
+  //Optionally start loading selected materials in the background (see
+  //NCRYSTAL_NXSLIB_PREWARM), once the plugin is actually used:
+  prewarmNXSMaterialsFromEnvOnce();
   if ( !NC::trim2(cfg.get_atomdb()).empty() )
     std::cout<<"NCrystal WARNING: atomdb parameter is ignored for .nxs files"<<std::endl;
-  auto builder = loadNXSCrystal( cfg.textData(),
-                                 cfg.get_temp().dbl()==-1.0?NC::Temperature{293.15}:cfg.get_temp(),
-                                 cfg.get_dcutoff(),
-                                 cfg.get_dcutoffup() );
-  builder.dataSourceName = cfg.dataSourceName();
-  return buildInfoPtr(std::move(builder));
+  const auto temp = ( cfg.get_temp().dbl()==-1.0 ? NC::Temperature{293.15} : cfg.get_temp() );
+  const SingleFlightLoads::Key key{ cfg.textData().dataUID().value,
+                                    temp.dbl(), cfg.get_dcutoff(), cfg.get_dcutoffup() };
+  return singleFlightLoads().getOrProduce( key, [&cfg,temp]()
+  {
+    auto builder = loadNXSCrystal( cfg.textData(),
+                                   temp,
+                                   cfg.get_dcutoff(),
+                                   cfg.get_dcutoffup() );
+    builder.dataSourceName = cfg.dataSourceName();
+    return buildInfoPtr(std::move(builder));
+  } );
+}
+
+const char * NCP::TextureFactory::name() const noexcept
+{
+  return NCPLUGIN_NAME_CSTR "TextureFactory";
+}
+
+NC::Priority NCP::TextureFactory::query( const NC::FactImpl::ScatterRequest& cfg ) const
+{
+  if ( !cfg.get_coh_elas() || !cfg.info().countCustomSections("NXSTEXTURE") )
+    return Priority::Unable;
+  //Just below BkgdFactory, which will defer to us for the remaining processes:
+  return Priority{998};
+}
+
+NC::ProcImpl::ProcPtr NCP::TextureFactory::produce( const NC::FactImpl::ScatterRequest& cfg ) const
+{
+  auto src = textureSourceRegistry().find( registryIdFromInfo( cfg.info(), "NXSTEXTURE" ) );
+  if ( !src )
+    NCRYSTAL_THROW(LogicError,"Texture data of material is no longer available");
+  auto sc_texture = NC::makeSO<NXSTexturedBragg>( src->model() );
+  auto sc_std = globalCreateScatter( cfg.modified("coh_elas=0") );
+  return NC::ProcImpl::FactoryJoin( sc_std, sc_texture );
+}
+
+const char * NCP::BkgdFactory::name() const noexcept
+{
+  return NCPLUGIN_NAME_CSTR "BkgdFactory";
+}
+
+NC::Priority NCP::BkgdFactory::query( const NC::FactImpl::ScatterRequest& cfg ) const
+{
+  if ( !cfg.info().countCustomSections("NXSBKGD") )
+    return Priority::Unable;
+  //The background represents both incoherent elastic and inelastic
+  //scattering, and is thus needed if either is enabled (NCrystal normalises
+  //all ways of disabling inelastic scattering to "none"):
+  if ( cfg.get_inelas() == "none" && !cfg.get_incoh_elas() )
+    return Priority::Unable;
+  return Priority{999};
+}
+
+NC::ProcImpl::ProcPtr NCP::BkgdFactory::produce( const NC::FactImpl::ScatterRequest& cfg ) const
+{
+  auto src = bkgdSourceRegistry().find( registryIdFromInfo( cfg.info(), "NXSBKGD" ) );
+  if ( !src )
+    NCRYSTAL_THROW(LogicError,"Background data of material is no longer available");
+  auto sc_std = globalCreateScatter( cfg.modified("incoh_elas=0;inelas=0") );
+  //Select the process specialised for the background model of the material:
+  return std::visit( [&sc_std]( const auto& bkgd )
+  {
+    using TSource = std::decay_t<decltype(bkgd)>;
+    auto sc_bkgd = NC::makeSO<NXSBkgdScatter<TSource::model>>( bkgd );
+    return NC::ProcImpl::FactoryJoin( sc_std, sc_bkgd );
+  }, *src );
 }
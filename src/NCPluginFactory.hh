@@ -13,6 +13,25 @@ namespace NCPluginNamespace {
     NC::Priority query( const NC::FactImpl::InfoRequest& ) const override;
     NC::InfoPtr produce( const NC::FactImpl::InfoRequest& ) const override;
   };
+
+  //Replaces the standard Bragg diffraction of materials loaded from .nxs data
+  //with texture specifications (see NCNXSTexture.hh):
+  class TextureFactory final : public NC::FactImpl::ScatterFactory {
+  public:
+    const char * name() const noexcept override;
+    NC::Priority query( const NC::FactImpl::ScatterRequest& ) const override;
+    NC::ProcImpl::ProcPtr produce( const NC::FactImpl::ScatterRequest& ) const override;
+  };
+
+  //Replaces the standard modelling of the background cross section of
+  //materials loaded from .nxs data with a dedicated process (see
+  //NCNXSBkgdScatter.hh):
+  class BkgdFactory final : public NC::FactImpl::ScatterFactory {
+  public:
+    const char * name() const noexcept override;
+    NC::Priority query( const NC::FactImpl::ScatterRequest& ) const override;
+    NC::ProcImpl::ProcPtr produce( const NC::FactImpl::ScatterRequest& ) const override;
+  };
 }
 
 #endif
@@ -20,9 +20,1058 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "NCTestPlugin.hh"
+#include "NCNXSBatchLoad.hh"
+#include "NCNXSBkgdModel.hh"
+#include "NCNXSBkgdScatter.hh"
+#include "NCNXSBkgdTable.hh"
+#include "NCNXSBraggEdges.hh"
+#include "NCNXSCompactHKL.hh"
+#include "NCNXSFSquare.hh"
+#include "NCNXSHKLCache.hh"
+#include "NCNXSHKLTools.hh"
+#include "NCNXSLib.hh"
+#include "NCNXSParse.hh"
+#include "NCNXSSingleFlight.hh"
+#include "NCNXSTexture.hh"
+#include "NCPluginFactory.hh"
+#include "NCrystal/factories/NCFactImpl.hh"
 #include "NCrystal/internal/utils/NCMsg.hh"
 #include "NCrystal/internal/utils/NCMath.hh"
 #include "NCrystal/internal/utils/NCStrView.hh"
+#include "NCrystal/internal/utils/NCVector.hh"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#if defined(__unix__) || defined(__APPLE__)
+#  include <dirent.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace NCPluginNamespace {
+  namespace {
+
+    //Line provider for nxs_readParameterFile reading from a string:
+    const char * s_nxsTestDataPos = nullptr;
+    char * readNXSTestDataLine( char * buf, int n )
+    {
+      if ( !s_nxsTestDataPos || !*s_nxsTestDataPos || n < 2 )
+        return nullptr;
+      const char * eol = std::strchr( s_nxsTestDataPos, '\n' );
+      std::size_t len = ( eol ? eol + 1 - s_nxsTestDataPos : std::strlen( s_nxsTestDataPos ) );
+      len = std::min<std::size_t>( len, n - 1 );
+      std::memcpy( buf, s_nxsTestDataPos, len );
+      buf[len] = '\0';
+      s_nxsTestDataPos += len;
+      return buf;
+    }
+
+    void testTriclinicDSpacings()
+    {
+      //Compare nxs_calcDhkl of a triclinic cell with d-spacings calculated
+      //from the explicit reciprocal lattice vectors:
+      NCRYSTAL_MSG("Testing triclinic d-spacings");
+      const double a = 5.1, b = 6.3, c = 7.2;
+      const double alpha = 81.0 * NC::kDeg, beta = 103.5 * NC::kDeg, gamma = 95.0 * NC::kDeg;
+      const char * testdata =
+        "space_group = 2\n"
+        "lattice_a = 5.1\n"
+        "lattice_b = 6.3\n"
+        "lattice_c = 7.2\n"
+        "lattice_alpha = 81\n"
+        "lattice_beta = 103.5\n"
+        "lattice_gamma = 95\n"
+        "debye_temp = 300\n"
+        "add_atom = Fe 9.45 0.4 2.56 55.8 0.11 0.22 0.33\n";
+      s_nxsTestDataPos = testdata;
+      nxs::NXS_UnitCell uc;
+      nxs::NXS_AtomInfo * atomInfoList = nullptr;
+      const int n = nxs::nxs_readParameterFile( readNXSTestDataLine, &uc, &atomInfoList );
+      s_nxsTestDataPos = nullptr;
+      std::free( atomInfoList );
+      nc_assert_always( n == 1 );
+      nc_assert_always( nxs::nxs_initUnitCell( &uc ) == NXS_ERROR_OK );
+
+      //Direct lattice vectors (a along x, b in the xy plane):
+      const NC::Vector a1( a, 0.0, 0.0 );
+      const NC::Vector a2( b * std::cos(gamma), b * std::sin(gamma), 0.0 );
+      const double c_x = c * std::cos(beta);
+      const double c_y = c * ( std::cos(alpha) - std::cos(beta) * std::cos(gamma) ) / std::sin(gamma);
+      const NC::Vector a3( c_x, c_y, std::sqrt( c * c - c_x * c_x - c_y * c_y ) );
+      const double volume = a1.dot( a2.cross( a3 ) );
+      const NC::Vector b1 = a2.cross( a3 ) / volume;
+      const NC::Vector b2 = a3.cross( a1 ) / volume;
+      const NC::Vector b3 = a1.cross( a2 ) / volume;
+      for ( int h = -3; h <= 3; ++h ) {
+        for ( int k = -3; k <= 3; ++k ) {
+          for ( int l = -3; l <= 3; ++l ) {
+            if ( !h && !k && !l )
+              continue;
+            const double dref = 1.0 / ( b1 * h + b2 * k + b3 * l ).mag();
+            const double d = nxs::nxs_calcDhkl( h, k, l, &uc );
+            if ( !( std::fabs( d - dref ) <= 1e-12 * dref ) )
+              NCRYSTAL_THROW2(CalcError,"Triclinic d-spacing of ("<<h<<","<<k<<","<<l<<") is "<<d
+                              <<" but should be "<<dref);
+          }
+        }
+      }
+      std::free( uc.sgInfo.ListSeitzMx );
+    }
+
+    //Data of a .nxs file bundled with the plugin:
+    NC::TextDataSP bundledNXSData( const std::string& filename )
+    {
+      return NC::FactImpl::createTextData( NC::TextDataPath( "plugins::nxslib/" + filename ) );
+    }
+
+    //Names of all .nxs files bundled with the plugin:
+    std::vector<std::string> bundledNXSFiles()
+    {
+      std::vector<std::string> res;
+      for ( auto& e : NC::DataSources::listAvailableFiles() ) {
+        NC::StrView name(e.name);
+        if ( e.factName == "plugins" && name.startswith("nxslib/") )
+          res.push_back( e.name.substr(7) );
+      }
+      return res;
+    }
+
+    void testParseNXSData( const NC::TextData& data )
+    {
+      //Compare parseNXSData with nxs_readParameterFile (reading the same lines
+      //with fgets semantics):
+      std::string text;
+      for ( const std::string& line : data )
+        text += line + '\n';
+      nxs::NXS_UnitCell uc_ref;
+      nxs::NXS_AtomInfo * atoms_ref = nullptr;
+      s_nxsTestDataPos = text.c_str();
+      const int n_ref = nxs::nxs_readParameterFile( readNXSTestDataLine, &uc_ref, &atoms_ref );
+      s_nxsTestDataPos = nullptr;
+      std::vector<nxs::NXS_AtomInfo> ref( atoms_ref, atoms_ref + std::max( n_ref, 0 ) );
+      std::free( atoms_ref );
+
+      nxs::NXS_UnitCell uc;
+      const auto atoms = parseNXSData( data, uc );
+      if ( n_ref < 0 || atoms.size() != ref.size() )
+        NCRYSTAL_THROW2(CalcError,"parseNXSData found "<<atoms.size()<<" atoms in "<<data.dataSourceName()
+                        <<" but nxs_readParameterFile returned "<<n_ref);
+      if ( std::strcmp( uc.spaceGroup, uc_ref.spaceGroup ) != 0
+           || uc.a != uc_ref.a || uc.b != uc_ref.b || uc.c != uc_ref.c
+           || uc.alpha != uc_ref.alpha || uc.beta != uc_ref.beta || uc.gamma != uc_ref.gamma
+           || uc.mph_c2 != uc_ref.mph_c2 || uc.debyeTemp != uc_ref.debyeTemp )
+        NCRYSTAL_THROW2(CalcError,"parseNXSData and nxs_readParameterFile disagree on unit cell of "
+                        <<data.dataSourceName());
+      for ( std::size_t i = 0; i < atoms.size(); ++i ) {
+        nxs::NXS_AtomInfo ai;
+        std::memset( &ai, 0, sizeof(ai) );
+        atoms[i].fill( ai );
+        const nxs::NXS_AtomInfo& ai_ref = ref[i];
+        if ( std::strcmp( ai.label, ai_ref.label ) != 0
+             || ai.b_coherent != ai_ref.b_coherent || ai.sigmaIncoherent != ai_ref.sigmaIncoherent
+             || ai.sigmaAbsorption != ai_ref.sigmaAbsorption || ai.molarMass != ai_ref.molarMass
+             || ai.debyeTemp != ai_ref.debyeTemp
+             || ai.x[0] != ai_ref.x[0] || ai.y[0] != ai_ref.y[0] || ai.z[0] != ai_ref.z[0] )
+          NCRYSTAL_THROW2(CalcError,"parseNXSData and nxs_readParameterFile disagree on atom "<<i
+                          <<" of "<<data.dataSourceName());
+      }
+    }
+
+    //Unit cell set up from .nxs data like in the factory (at room temperature,
+    //and with nxslib's own structure factor evaluation), including the hkl
+    //lattice planes:
+    class NXSTestCell final : private NC::NoCopyMove {
+    public:
+      NXSTestCell( const NC::TextData& data, unsigned maxhkl )
+      {
+        std::vector<nxs::NXS_AtomInfo> atoms;
+        for ( auto& site : parseNXSData( data, uc ) ) {
+          nxs::NXS_AtomInfo ai;
+          std::memset( &ai, 0, sizeof(ai) );
+          site.fill( ai );
+          atoms.push_back( ai );
+        }
+        init( atoms, maxhkl );
+      }
+
+      //From data in a string, read with nxs_readParameterFile:
+      NXSTestCell( const char * data, unsigned maxhkl )
+      {
+        s_nxsTestDataPos = data;
+        nxs::NXS_AtomInfo * atomInfoList = nullptr;
+        const int n = nxs::nxs_readParameterFile( readNXSTestDataLine, &uc, &atomInfoList );
+        s_nxsTestDataPos = nullptr;
+        std::vector<nxs::NXS_AtomInfo> atoms( atomInfoList, atomInfoList + std::max( n, 0 ) );
+        std::free( atomInfoList );
+        nc_assert_always( n > 0 );
+        init( atoms, maxhkl );
+      }
+
+      ~NXSTestCell()
+      {
+        for ( unsigned i = 0; i < uc.nHKL; ++i )
+          std::free( uc.hklList[i].equivHKL );
+        std::free( uc.hklList );
+        std::free( uc.hklCumFMd );
+        std::free( uc.sgInfo.ListSeitzMx );
+        std::free( uc.atomInfoList );
+      }
+
+      nxs::NXS_UnitCell uc;
+
+    private:
+      void init( const std::vector<nxs::NXS_AtomInfo>& atoms, unsigned maxhkl )
+      {
+        nc_assert_always( nxs::nxs_initUnitCell( &uc ) == NXS_ERROR_OK );
+        uc.temperature = 293.15;
+        for ( auto& ai : atoms )
+          nxs::nxs_addAtomInfo( &uc, ai );
+        nxs::nxs_initAverageSigma( &uc, 0 );
+        uc.maxHKL_index = maxhkl;
+        nc_assert_always( nxs::nxs_initHKLList( &uc ) == NXS_ERROR_OK );
+      }
+    };
+
+    //All hkl families of a unit cell, converted as in the factory (but without
+    //any cuts):
+    NC::HKLList testHKLList( const nxs::NXS_UnitCell& uc )
+    {
+      NC::HKLList hklList;
+      for ( unsigned i = 0; i < uc.nHKL; ++i ) {
+        const nxs::NXS_HKL& e = uc.hklList[i];
+        NC::HKLInfo hi;
+        hi.hkl.h = e.h;
+        hi.hkl.k = e.k;
+        hi.hkl.l = e.l;
+        hi.multiplicity = e.multiplicity;
+        hi.dspacing = e.dhkl;
+        hi.fsquared = 0.01 * e.FSquare;
+        hi.explicitValues = std::make_unique<NC::HKLInfo::ExplicitVals>();
+        for ( unsigned j = 0; j < e.nEquivHKL; ++j )
+          hi.explicitValues->list.push_back( NC::HKL{ e.equivHKL[j].h, e.equivHKL[j].k, e.equivHKL[j].l } );
+        hklList.push_back( std::move(hi) );
+      }
+      return hklList;
+    }
+
+    bool sameHKL( const NC::HKL& a, const NC::HKL& b )
+    {
+      return a.h == b.h && a.k == b.k && a.l == b.l;
+    }
+
+    //Whether two lists are identical, including the explicit hkl values:
+    bool sameHKLLists( const NC::HKLList& a, const NC::HKLList& b )
+    {
+      if ( a.size() != b.size() )
+        return false;
+      for ( std::size_t i = 0; i < a.size(); ++i ) {
+        const NC::HKLInfo& ea = a[i];
+        const NC::HKLInfo& eb = b[i];
+        if ( !sameHKL( ea.hkl, eb.hkl ) || ea.multiplicity != eb.multiplicity
+             || ea.dspacing != eb.dspacing || ea.fsquared != eb.fsquared
+             || !ea.explicitValues != !eb.explicitValues )
+          return false;
+        if ( !ea.explicitValues )
+          continue;
+        const auto& la = ea.explicitValues->list;
+        const auto& lb = eb.explicitValues->list;
+        if ( la.size() != lb.size() || !std::equal( la.begin(), la.end(), lb.begin(), sameHKL ) )
+          return false;
+      }
+      return true;
+    }
+
+    //Coherent elastic cross section of an hkl list at wavelength 2*dmin, up to
+    //a constant factor:
+    double braggSum( const NC::HKLList& hklList, double dmin )
+    {
+      double sum = 0.0;
+      for ( auto& e : hklList )
+        if ( e.dspacing >= dmin )
+          sum += e.multiplicity * e.fsquared * e.dspacing;
+      return sum;
+    }
+
+    void testMergeEqualDSpacings( const NC::TextData& data, bool expect_merged )
+    {
+      //Merged lists must have strictly decreasing d-spacings and consistent
+      //explicit hkl values, preserve the sums of multiplicity and
+      //multiplicity*|F|^2, and give the same cross sections up to the
+      //tolerance between the Bragg edges:
+      NCRYSTAL_MSG("Testing mergeEqualDSpacings with "<<data.dataSourceName());
+      const double dtol = 1e-6;
+      NXSTestCell cell( data, 8 );
+      const NC::HKLList full = testHKLList( cell.uc );
+      const NC::HKLList merged = mergeEqualDSpacings( testHKLList( cell.uc ), dtol );
+      double sum_m = 0.0, sum_mf = 0.0, sum_m_merged = 0.0, sum_mf_merged = 0.0;
+      for ( auto& e : full ) {
+        sum_m += e.multiplicity;
+        sum_mf += e.multiplicity * e.fsquared;
+      }
+      for ( std::size_t i = 0; i < merged.size(); ++i ) {
+        const NC::HKLInfo& e = merged[i];
+        sum_m_merged += e.multiplicity;
+        sum_mf_merged += e.multiplicity * e.fsquared;
+        if ( i > 0 && !( e.dspacing < merged[i-1].dspacing ) )
+          NCRYSTAL_THROW2(CalcError,"mergeEqualDSpacings left unmerged entries at d="<<e.dspacing);
+        if ( !e.explicitValues || 2 * e.explicitValues->list.size() != e.multiplicity )
+          NCRYSTAL_THROW2(CalcError,"mergeEqualDSpacings produced inconsistent explicit hkl values at d="
+                          <<e.dspacing);
+      }
+      if ( expect_merged != ( merged.size() < full.size() ) )
+        NCRYSTAL_THROW2(CalcError,"mergeEqualDSpacings merged "<<full.size()<<" entries into "<<merged.size());
+      if ( sum_m_merged != sum_m || !( std::fabs( sum_mf_merged - sum_mf ) <= 1e-12 * sum_mf ) )
+        NCRYSTAL_THROW(CalcError,"mergeEqualDSpacings changed the summed multiplicities or |F|^2");
+      for ( std::size_t i = 0; i + 1 < full.size(); ++i ) {
+        const double d0 = full[i].dspacing;
+        const double d1 = full[i+1].dspacing;
+        if ( d0 - d1 <= dtol * d0 )
+          continue;
+        const double ref = braggSum( full, 0.5 * ( d0 + d1 ) );
+        const double val = braggSum( merged, 0.5 * ( d0 + d1 ) );
+        if ( !( std::fabs( val - ref ) <= dtol * ref ) )
+          NCRYSTAL_THROW2(CalcError,"mergeEqualDSpacings changed cross section at lambda="<<( d0 + d1 )
+                          <<" by a relative "<<( val - ref ) / ref);
+      }
+    }
+
+    void testPruneHKLList( const NC::TextData& data, double budget )
+    {
+      //Pruning must keep the remaining families in their original order, and
+      //change the cross section at each Bragg edge (and thus everywhere) by at
+      //most the budget:
+      NCRYSTAL_MSG("Testing pruneHKLList with "<<data.dataSourceName()<<" and budget "<<budget);
+      NXSTestCell cell( data, 8 );
+      const NC::HKLList full = testHKLList( cell.uc );
+      const NC::HKLList pruned = pruneHKLList( testHKLList( cell.uc ), budget );
+      if ( !( pruned.size() < full.size() ) )
+        NCRYSTAL_THROW2(CalcError,"pruneHKLList removed no families from "<<data.dataSourceName());
+      std::size_t j = 0;
+      for ( auto& e : full )
+        if ( j < pruned.size() && sameHKL( e.hkl, pruned[j].hkl ) && e.dspacing == pruned[j].dspacing )
+          ++j;
+      if ( j != pruned.size() )
+        NCRYSTAL_THROW(CalcError,"pruneHKLList did not keep the order of the remaining families");
+      for ( auto& e : full ) {
+        const double ref = braggSum( full, e.dspacing );
+        const double val = braggSum( pruned, e.dspacing );
+        if ( !( std::fabs( val - ref ) <= budget * ref * ( 1.0 + 1e-12 ) ) )
+          NCRYSTAL_THROW2(CalcError,"pruneHKLList changed cross section at lambda="<<2.0 * e.dspacing
+                          <<" by a relative "<<( val - ref ) / ref<<" with budget "<<budget);
+      }
+    }
+
+    void testCompactHKL( const NC::TextData& data )
+    {
+      //Check NXSCompactHKL against the hkl list of the unit cell and
+      //nxs_CoherentElastic, according to its accuracy contract:
+      NCRYSTAL_MSG("Testing NXSCompactHKL with "<<data.dataSourceName());
+      NXSTestCell cell( data, 12 );
+      const NXSCompactHKL compact( cell.uc );
+      const std::size_t n = compact.size();
+      if ( n != cell.uc.nHKL )
+        NCRYSTAL_THROW2(CalcError,"NXSCompactHKL has "<<n<<" planes but unit cell has "<<cell.uc.nHKL);
+
+      //Planes might be reordered slightly (nxslib sorts with a tolerance), so
+      //compare them after sorting both by Miller indices:
+      struct Plane { int h, k, l; double d, fsqmult; };
+      auto byHKL = []( const Plane& a, const Plane& b )
+      {
+        return a.h != b.h ? a.h < b.h : ( a.k != b.k ? a.k < b.k : a.l < b.l );
+      };
+      std::vector<Plane> planes, planes_ref;
+      for ( std::size_t i = 0; i < n; ++i ) {
+        if ( i > 0 && compact.dspacing(i) > compact.dspacing(i-1) )
+          NCRYSTAL_THROW(CalcError,"NXSCompactHKL planes are not sorted by d-spacing");
+        planes.push_back( { compact.h(i), compact.k(i), compact.l(i), compact.dspacing(i), compact.fsqmult(i) } );
+        const nxs::NXS_HKL& e = cell.uc.hklList[i];
+        planes_ref.push_back( { e.h, e.k, e.l, e.dhkl, e.FSquare * e.multiplicity } );
+      }
+      std::sort( planes.begin(), planes.end(), byHKL );
+      std::sort( planes_ref.begin(), planes_ref.end(), byHKL );
+      const double float_eps = std::ldexp( 1.0, -24 );
+      const double float_min = std::numeric_limits<float>::min();
+      for ( std::size_t i = 0; i < n; ++i ) {
+        const Plane& p = planes[i];
+        const Plane& r = planes_ref[i];
+        if ( p.h != r.h || p.k != r.k || p.l != r.l
+             || !( std::fabs( p.d - r.d ) <= float_eps * r.d )
+             || !( std::fabs( p.fsqmult - r.fsqmult ) <= float_eps * r.fsqmult + float_min ) )
+          NCRYSTAL_THROW2(CalcError,"NXSCompactHKL plane ("<<p.h<<","<<p.k<<","<<p.l
+                          <<") differs from nxslib plane ("<<r.h<<","<<r.k<<","<<r.l<<")");
+      }
+
+      //Cross sections, except very close to Bragg edges:
+      const std::size_t nlambda = 2000;
+      const double lambda_max = 2.2 * planes_ref.front().d;
+      std::vector<double> lambdas, xsects( nlambda );
+      for ( std::size_t i = 0; i < nlambda; ++i )
+        lambdas.push_back( 0.1 + ( lambda_max - 0.1 ) * i / ( nlambda - 1 ) );
+      compact.coherentElasticSweep( nlambda, lambdas.data(), xsects.data() );
+      for ( std::size_t i = 0; i < nlambda; ++i ) {
+        const double lambda = lambdas[i];
+        bool near_edge = false;
+        for ( auto& r : planes_ref )
+          near_edge = near_edge || std::fabs( lambda - 2.0 * r.d ) <= 1e-7 * lambda + 1e-6;
+        if ( near_edge )
+          continue;
+        const double ref = nxs::nxs_CoherentElastic( lambda, &cell.uc );
+        const double val = compact.coherentElastic( lambda );
+        if ( !( std::fabs( val - ref ) <= 1e-12 * ref ) || xsects[i] != val )
+          NCRYSTAL_THROW2(CalcError,"NXSCompactHKL cross section at lambda="<<lambda<<" is "<<val
+                          <<" (sweep: "<<xsects[i]<<") but nxs_CoherentElastic gives "<<ref);
+      }
+    }
+
+    void testCoherentElasticCumSums( const NC::TextData& data )
+    {
+      //nxs_CoherentElastic with the cumulative sums must give the same results
+      //as the original linear scan of the list (used when hklCumFMd is null),
+      //also exactly on and within 1e-4 Aa of the Bragg edges, where the edge
+      //correction is needed:
+      NCRYSTAL_MSG("Testing cumulative sums of nxs_CoherentElastic with "<<data.dataSourceName());
+      NXSTestCell cell( data, 8 );
+      nxs::NXS_UnitCell& uc = cell.uc;
+      nc_assert_always( uc.hklCumFMd != nullptr && uc.nHKL > 10 );
+      const double sum_all = uc.hklCumFMd[uc.nHKL];
+      const double offsets[] = { -1.0001e-4, -9.99e-5, -5e-5, -1e-6, -1e-9, 0.0, 1e-9,
+                                 5e-7, 1e-6 - 1e-12, 1e-6, 1e-6 + 1e-12, 2e-6, 5e-5, 9.99e-5, 1.0001e-4 };
+      for ( unsigned i = 0; i < std::min<unsigned>( uc.nHKL, 100 ); ++i ) {
+        for ( double offset : offsets ) {
+          const double lambda = 2.0 * uc.hklList[i].dhkl + offset;
+          const double val = nxs::nxs_CoherentElastic( lambda, &uc );
+          double * cumsums = uc.hklCumFMd;
+          uc.hklCumFMd = nullptr;
+          const double ref = nxs::nxs_CoherentElastic( lambda, &uc );
+          uc.hklCumFMd = cumsums;
+          const double scale = sum_all * 1E-2 * lambda * lambda / ( 2.0 * uc.volume );
+          if ( !( std::fabs( val - ref ) <= 1e-12 * scale ) )
+            NCRYSTAL_THROW2(CalcError,"nxs_CoherentElastic at lambda=2*d+"<<offset<<" for hkl=("
+                            <<uc.hklList[i].h<<","<<uc.hklList[i].k<<","<<uc.hklList[i].l<<") gives "<<val
+                            <<" but the linear scan gives "<<ref);
+        }
+      }
+    }
+
+    void testCoherentElasticSpectrum( const NC::TextData& data )
+    {
+      //coherentElasticSpectrum must reproduce nxs_CoherentElastic at each
+      //point, both serially and when the grid is large enough to actually be
+      //split between 4 threads. The grid includes points on and next to the
+      //Bragg edges:
+      NCRYSTAL_MSG("Testing coherentElasticSpectrum with "<<data.dataSourceName());
+      NXSTestCell cell( data, 8 );
+      nxs::NXS_UnitCell& uc = cell.uc;
+      //Chunks have at least 4096 points (and at least one per plane):
+      const unsigned nthreads = 4;
+      const std::size_t nmin = ( nthreads + 1 ) * std::max<std::size_t>( 4096, uc.nHKL );
+      const double lambda_max = 2.2 * uc.hklList[0].dhkl;
+      std::vector<double> lambdas;
+      for ( unsigned i = 0; i < uc.nHKL; ++i )
+        for ( double offset : { -5e-5, 0.0, 1e-6, 5e-5 } )
+          lambdas.push_back( 2.0 * uc.hklList[i].dhkl + offset );
+      while ( lambdas.size() < nmin )
+        lambdas.push_back( 0.1 + ( lambda_max - 0.1 ) * lambdas.size() / nmin );
+      std::sort( lambdas.begin(), lambdas.end() );
+      const std::size_t n = lambdas.size();
+      std::vector<double> ref( n );
+      for ( std::size_t i = 0; i < n; ++i )
+        ref[i] = nxs::nxs_CoherentElastic( lambdas[i], &uc );
+      const NXSCompactHKL compact( uc );
+      for ( unsigned nt : { 1u, nthreads } ) {
+        std::vector<double> xsects( n, -1.0 ), xsects_compact( n, -1.0 );
+        coherentElasticSpectrum( uc, n, lambdas.data(), xsects.data(), nt );
+        coherentElasticSpectrum( compact, n, lambdas.data(), xsects_compact.data(), nt );
+        for ( std::size_t i = 0; i < n; ++i ) {
+          if ( xsects[i] != ref[i] )
+            NCRYSTAL_THROW2(CalcError,"coherentElasticSpectrum (nthreads="<<nt<<") at lambda="<<lambdas[i]
+                            <<" gives "<<xsects[i]<<" but nxs_CoherentElastic gives "<<ref[i]);
+          if ( xsects_compact[i] != compact.coherentElastic( lambdas[i] ) )
+            NCRYSTAL_THROW2(CalcError,"coherentElasticSpectrum of NXSCompactHKL (nthreads="<<nt<<") at lambda="
+                            <<lambdas[i]<<" differs from NXSCompactHKL::coherentElastic");
+        }
+      }
+    }
+
+    //Al with two preferred orientations:
+    const char * s_texturedTestData =
+      "space_group = 225\n"
+      "lattice_a = 4.049\n"
+      "lattice_b = 4.049\n"
+      "lattice_c = 4.049\n"
+      "lattice_alpha = 90\n"
+      "lattice_beta  = 90\n"
+      "lattice_gamma = 90\n"
+      "debye_temp = 429.0\n"
+      "texture = 1 1 1 0.7 0.6\n"
+      "texture = 1 0 0 1.3 0.4\n"
+      "[atoms]\n"
+      "add_atom = Al 3.449 0.008 0.23 26.98 0.0 0.0 0.0\n";
+
+    //True if the process is (or is a composition including) a T:
+    template<class T>
+    bool containsProcess( const NC::ProcImpl::Process& proc )
+    {
+      if ( dynamic_cast<const T*>( &proc ) )
+        return true;
+      if ( auto comp = dynamic_cast<const NC::ProcImpl::ProcComposition*>( &proc ) )
+        for ( auto& c : comp->components() )
+          if ( containsProcess<T>( *c.process ) )
+            return true;
+      return false;
+    }
+
+    void testTextureModel()
+    {
+      //Cross sections of NXSTextureModel, interpolating in the table of
+      //texture corrections, must agree with nxs_CoherentElasticTexture
+      //integrating at each wavelength (per atom, i.e. divided by nAtoms) to a
+      //relative 5e-3. Deviations are largest just below the edges, where the
+      //corrections change fastest (~3e-3 with the default 128 grid points):
+      NCRYSTAL_MSG("Testing NXSTextureModel");
+      NXSTestCell cell( s_texturedTestData, 4 );
+      const std::vector<NXSTextureParams> textures = { { 1, 1, 1, 0.7, 0.6 }, { 1, 0, 0, 1.3, 0.4 } };
+      const NXSTextureModel model( cell.uc, textures, { 0.0, NC::kInfinity } );
+      nxs::NXS_MarchDollase md = nxs::nxs_initMarchDollase( &cell.uc );
+      struct Guard {
+        nxs::NXS_MarchDollase& md;
+        ~Guard() { nxs::nxs_freeMarchDollase( &md ); }
+      } guard{md};
+      for ( auto& t : textures ) {
+        nxs::NXS_Texture texture;
+        std::memset( &texture, 0, sizeof(texture) );
+        texture.a = t.a;
+        texture.b = t.b;
+        texture.c = t.c;
+        texture.r = t.r;
+        texture.f = t.f;
+        nxs::nxs_addTexture( &md, texture );
+      }
+      const double dmax = cell.uc.hklList[0].dhkl;
+      if ( !( model.braggThreshold().dbl() == 2.0 * dmax ) )
+        NCRYSTAL_THROW(CalcError,"NXSTextureModel has wrong Bragg threshold");
+      const unsigned nlambda = 60;
+      for ( unsigned i = 0; i < nlambda; ++i ) {
+        const double lambda = 0.5 + ( 2.2 * dmax - 0.5 ) * ( i + 0.5 ) / nlambda;
+        bool near_edge = false;
+        for ( unsigned j = 0; j < cell.uc.nHKL; ++j )
+          near_edge = near_edge || std::fabs( lambda - 2.0 * cell.uc.hklList[j].dhkl ) < 1e-5;
+        if ( near_edge )
+          continue;
+        const double ref = nxs::nxs_CoherentElasticTexture( lambda, &md ) / cell.uc.nAtoms;
+        const double val = model.crossSection( NC::NeutronWavelength{ lambda } ).dbl();
+        if ( !( std::fabs( val - ref ) <= 5e-3 * ref ) )
+          NCRYSTAL_THROW2(CalcError,"NXSTextureModel cross section at lambda="<<lambda<<" is "<<val
+                          <<" but nxs_CoherentElasticTexture gives "<<ref);
+      }
+    }
+
+    void testTexturedScatter()
+    {
+      //Textured material must get its Bragg diffraction from NXSTexturedBragg
+      //(i.e. via TextureFactory), but only if coherent elastic scattering is
+      //enabled:
+      NCRYSTAL_MSG("Testing scattering of textured material");
+      auto sc = NC::createScatter( NC::MatCfg::createFromRawData( std::string(s_texturedTestData), "", "nxs" ) );
+      if ( !containsProcess<NXSTexturedBragg>( sc.underlying() ) )
+        NCRYSTAL_THROW(CalcError,"Scatter process of textured material does not include NXSTexturedBragg");
+      auto sc_nobragg = NC::createScatter( NC::MatCfg::createFromRawData( std::string(s_texturedTestData),
+                                                                          ";coh_elas=0", "nxs" ) );
+      if ( containsProcess<NXSTexturedBragg>( sc_nobragg.underlying() ) )
+        NCRYSTAL_THROW(CalcError,"Scatter process of textured material with coh_elas=0 includes NXSTexturedBragg");
+    }
+
+    //Background cross section per unit cell of the given model, as a sum of
+    //the original nxslib functions. For setting tolerances, scale is set to
+    //the sum of the absolute values of the terms and of the total scattering
+    //cross section of the atoms (the multi-phonon terms are differences of
+    //numbers of that size):
+    double nxsBkgdReference( NXSBkgdModel model, double lambda, nxs::NXS_UnitCell& uc, double& scale )
+    {
+      std::vector<double> terms = { nxs::nxs_IncoherentElastic( lambda, &uc ) };
+      if ( model == NXSBkgdModel::McStas ) {
+        terms.push_back( nxs::nxs_TotalInelastic_BINDER( lambda, &uc ) );
+      } else {
+        terms.push_back( nxs::nxs_SinglePhonon( lambda, &uc ) );
+        if ( model == NXSBkgdModel::NXSG4_Cassels )
+          terms.push_back( nxs::nxs_MultiPhonon_CASSELS( lambda, &uc ) );
+        else if ( model == NXSBkgdModel::NXSG4_Freund )
+          terms.push_back( nxs::nxs_MultiPhonon_FREUND( lambda, &uc ) );
+        else
+          terms.push_back( nxs::nxs_MultiPhonon_COMBINED( lambda, &uc ) );
+      }
+      double sum = 0.0;
+      scale = uc.nAtoms * ( uc.avgSigmaCoherent + uc.avgSigmaIncoherent );
+      for ( double t : terms ) {
+        sum += t;
+        scale += std::fabs( t );
+      }
+      return sum;
+    }
+
+    void testBkgdKernel( const NC::TextData& data )
+    {
+      //NXSBkgdKernel::eval of each model must agree with the sum of the nxslib
+      //functions it replaces, at several temperatures and on a wavelength grid
+      //which includes the switch-over points of nxs_MultiPhonon_COMBINED:
+      NCRYSTAL_MSG("Testing NXSBkgdKernel with "<<data.dataSourceName());
+      NXSTestCell cell( data, 1 );
+      nxs::NXS_UnitCell& uc = cell.uc;
+      const double lambda_debye = 30.8106673293723 / std::sqrt( uc.debyeTemp );
+      const double lambda_cassels = lambda_debye * 1.78789683887;
+      const double lambda_freund = lambda_debye * 3.68096408002;
+      std::vector<double> lambdas;
+      for ( unsigned i = 0; i < 200; ++i )
+        lambdas.push_back( 0.05 + 1.5 * lambda_freund * i / 199 );
+      for ( double l : { lambda_cassels, lambda_freund } )
+        for ( double f : { 1.0 - 1e-9, 1.0, 1.0 + 1e-9 } )
+          lambdas.push_back( l * f );
+      for ( double temperature : { 20.0, 293.15, 600.0 } ) {
+        nxs::nxs_setTemperature( &uc, temperature );
+        for ( auto model : { NXSBkgdModel::NXSG4, NXSBkgdModel::NXSG4_Cassels,
+                             NXSBkgdModel::NXSG4_Freund, NXSBkgdModel::McStas } ) {
+          const NXSBkgdKernel kernel( uc, model );
+          visitNXSBkgdModel( model, [&]( auto tmodel )
+          {
+            for ( double lambda : lambdas ) {
+              double scale;
+              const double ref = nxsBkgdReference( model, lambda, uc, scale );
+              const double val = kernel.eval<decltype(tmodel)::value>( lambda );
+              if ( !( std::fabs( val - ref ) <= 1e-12 * scale ) )
+                NCRYSTAL_THROW2(CalcError,"NXSBkgdKernel ("<<nxsBkgdModelName( model )<<") at T="<<temperature
+                                <<"K and lambda="<<lambda<<" gives "<<val<<" but nxslib gives "<<ref);
+            }
+          } );
+        }
+      }
+    }
+
+    void testBkgdTable( const NC::TextData& data )
+    {
+      //The interpolation error of NXSBkgdTable with the default grid must be
+      //within its documented bound (1% of the larger of the cross section and
+      //1% of the bound scattering cross section), at temperatures and
+      //wavelengths between the grid points:
+      NCRYSTAL_MSG("Testing NXSBkgdTable with "<<data.dataSourceName());
+      NXSTestCell cell( data, 1 );
+      nxs::NXS_UnitCell& uc = cell.uc;
+      const double sigma_bound = uc.avgSigmaCoherent + uc.avgSigmaIncoherent;
+      for ( auto model : { NXSBkgdModel::NXSG4, NXSBkgdModel::McStas } ) {
+        const NXSBkgdTable table( uc, model, NXSBkgdTable::Grid() );
+        for ( double temperature : { 7.77, 20.3, 77.7, 293.15, 611.1, 1234.5 } ) {
+          const auto tw = table.temperatureWeights( temperature );
+          nxs::nxs_setTemperature( &uc, temperature );
+          const NXSBkgdKernel kernel( uc, model );
+          visitNXSBkgdModel( model, [&]( auto tmodel )
+          {
+            for ( double lambda = 0.0123; lambda < 95.0; lambda *= 1.0371 ) {
+              const double ref = std::max( 0.0, kernel.eval<decltype(tmodel)::value>( lambda ) / uc.nAtoms );
+              const double val = table.xsect( tw, lambda );
+              if ( !( std::fabs( val - ref ) <= 1e-2 * std::max( ref, 1e-2 * sigma_bound ) ) )
+                NCRYSTAL_THROW2(CalcError,"NXSBkgdTable ("<<nxsBkgdModelName( model )<<") at T="<<temperature
+                                <<"K and lambda="<<lambda<<" gives "<<val<<" but NXSBkgdKernel gives "<<ref);
+            }
+          } );
+        }
+      }
+    }
+
+    //Background source of a loaded material:
+    std::shared_ptr<const NXSBkgdSource> bkgdSourceOf( const NC::Info& info )
+    {
+      auto src = bkgdSourceRegistry().find( registryIdFromInfo( info, "NXSBKGD" ) );
+      if ( !src )
+        NCRYSTAL_THROW(CalcError,"Background source of loaded material not found");
+      return src;
+    }
+
+    void testSharedBkgdTable()
+    {
+      //Materials loaded with NCRYSTAL_NXSLIB_BKGDTABLE set must take their
+      //background from a table, shared by all temperatures of the same data,
+      //while materials loaded without it evaluate the kernel:
+#if defined(__unix__) || defined(__APPLE__)
+      NCRYSTAL_MSG("Testing shared background tables");
+      const char * envname = "NCRYSTAL_NXSLIB_BKGDTABLE";
+      const char * oldvalue = std::getenv( envname );
+      struct RestoreEnv {
+        const char * name;
+        std::string value;
+        bool wasSet;
+        ~RestoreEnv()
+        {
+          if ( wasSet )
+            ::setenv( name, value.c_str(), 1 );
+          else
+            ::unsetenv( name );
+        }
+      } restoreEnv{ envname, oldvalue ? oldvalue : "", oldvalue != nullptr };
+      auto tableOf = []( const NXSBkgdSource& src )
+      {
+        return std::visit( []( const auto& bkgd ) { return bkgd.table(); }, src );
+      };
+
+      ::setenv( envname, "1", 1 );
+      auto info1 = NC::createInfo( "plugins::nxslib/Zr_sg194.nxs;temp=111.1K" );
+      auto info2 = NC::createInfo( "plugins::nxslib/Zr_sg194.nxs;temp=222.2K" );
+      ::unsetenv( envname );
+      auto info3 = NC::createInfo( "plugins::nxslib/Zr_sg194.nxs;temp=333.3K" );
+      auto src1 = bkgdSourceOf( *info1 );
+      auto src2 = bkgdSourceOf( *info2 );
+      const NXSBkgdTable * table = tableOf( *src1 );
+      if ( !table )
+        NCRYSTAL_THROW(CalcError,"No background table used with NCRYSTAL_NXSLIB_BKGDTABLE set");
+      if ( tableOf( *src2 ) != table )
+        NCRYSTAL_THROW(CalcError,"Background table not shared between temperatures of the same data");
+      if ( tableOf( *bkgdSourceOf( *info3 ) ) )
+        NCRYSTAL_THROW(CalcError,"Background table used without NCRYSTAL_NXSLIB_BKGDTABLE set");
+      const auto tw = table->temperatureWeights( 222.2 );
+      for ( double lambda : { 0.5, 1.8, 4.0, 12.0 } ) {
+        const double val = std::visit( [lambda]( const auto& bkgd ) { return bkgd.xsectPerAtom( lambda ); }, *src2 );
+        if ( val != table->xsect( tw, lambda ) )
+          NCRYSTAL_THROW2(CalcError,"Background cross section at lambda="<<lambda<<" not taken from the table");
+      }
+#endif
+    }
+
+    void testBkgdScatter( const std::string& filename )
+    {
+      //The scatter process of a material must be the Bragg diffraction plus
+      //the background process of BkgdFactory, which must not be used when
+      //only coherent elastic scattering is requested:
+      NCRYSTAL_MSG("Testing background scatter process of "<<filename);
+      const std::string cfgstr = "plugins::nxslib/" + filename;
+      const std::string cfgstr_bragg = cfgstr + ";comp=coh_elas";
+      auto info = NC::createInfo( cfgstr );
+      auto src = bkgdSourceOf( *info );
+      auto sc = NC::createScatter( cfgstr );
+      auto sc_bragg = NC::createScatter( cfgstr_bragg );
+      if ( BkgdFactory().query( NC::FactImpl::ScatterRequest( NC::MatCfg( cfgstr_bragg ) ) ).canServiceRequest() )
+        NCRYSTAL_THROW(CalcError,"BkgdFactory accepts request with comp=coh_elas");
+      auto hasBkgdProcess = [&src]( const NC::Scatter& scatter )
+      {
+        return std::visit( [&scatter]( const auto& bkgd )
+        {
+          using TSource = std::decay_t<decltype(bkgd)>;
+          return containsProcess<NXSBkgdScatter<TSource::model>>( scatter.underlying() );
+        }, *src );
+      };
+      if ( !hasBkgdProcess( sc ) || hasBkgdProcess( sc_bragg ) )
+        NCRYSTAL_THROW(CalcError,"Background scatter process missing, or present with comp=coh_elas");
+      for ( double lambda : { 0.5, 1.0, 1.8, 2.5, 4.0, 7.0, 12.0 } ) {
+        const NC::NeutronEnergy ekin = NC::NeutronWavelength{ lambda }.energy();
+        const double bkgd = std::visit( [lambda]( const auto& b ) { return b.xsectPerAtom( lambda ); }, *src );
+        const double bragg = sc_bragg.crossSectionIsotropic( ekin ).dbl();
+        const double total = sc.crossSectionIsotropic( ekin ).dbl();
+        if ( !( bkgd > 0.0 ) || !( std::fabs( total - ( bragg + bkgd ) ) <= 1e-12 * total ) )
+          NCRYSTAL_THROW2(CalcError,"Cross section of "<<cfgstr<<" at lambda="<<lambda<<" is "<<total
+                          <<" but Bragg and background parts give "<<bragg<<" + "<<bkgd);
+      }
+    }
+
+    void testFSquareFFT()
+    {
+      //Compare the structure factors from the NUFFT with those of the direct
+      //sums (and of nxslib itself), for a triclinic cell with many atoms of
+      //three species at pseudo-random positions:
+      NCRYSTAL_MSG("Testing NUFFT structure factors");
+      std::string testdata =
+        "space_group = 1\n"
+        "lattice_a = 9.1\n"
+        "lattice_b = 10.3\n"
+        "lattice_c = 11.7\n"
+        "lattice_alpha = 88\n"
+        "lattice_beta = 95\n"
+        "lattice_gamma = 101\n"
+        "debye_temp = 350\n";
+      const char * species[3] = { "Fe 9.45 0.4 2.56 55.85", "O 5.803 0.0008 0.00019 15.999", "Si 4.1491 0.004 0.171 28.085" };
+      const unsigned natoms = 60;
+      double sum_b = 0.0;
+      std::uint32_t rng = 12345;
+      auto uniform = [&rng]() { rng = rng * 1664525u + 1013904223u; return ( rng >> 8 ) * ( 1.0 / 16777216.0 ); };
+      for ( unsigned i = 0; i < natoms; ++i ) {
+        std::ostringstream ss;
+        ss.precision(10);
+        ss << "add_atom = " << species[i%3] << ' ' << uniform() << ' ' << uniform() << ' ' << uniform() << '\n';
+        testdata += ss.str();
+        sum_b += ( i%3 == 0 ? 9.45 : ( i%3 == 1 ? 5.803 : 4.1491 ) );
+      }
+      NXSTestCell cell( testdata.c_str(), 6 );
+      const unsigned n = cell.uc.nHKL;
+      nc_assert_always( cell.uc.nAtoms == natoms && n > 1000 );
+      const std::vector<nxs::NXS_HKL> ref( cell.uc.hklList, cell.uc.hklList + n );
+      double fsq_max = 0.0;
+      for ( auto& e : ref )
+        fsq_max = std::max( fsq_max, e.FSquare );
+
+      auto check = [&ref,n,sum_b,fsq_max]( const std::vector<nxs::NXS_HKL>& v, const char * what,
+                                           double reltol_strong )
+      {
+        for ( unsigned i = 0; i < n; ++i ) {
+          const double dev = std::fabs( v[i].FSquare - ref[i].FSquare );
+          const bool strong = ref[i].FSquare > 1e-2 * fsq_max;
+          if ( !( dev <= 1e-10 * sum_b * sum_b ) || ( strong && !( dev <= reltol_strong * ref[i].FSquare ) ) )
+            NCRYSTAL_THROW2(CalcError,what<<" gives |F|^2="<<v[i].FSquare<<" for hkl=("<<ref[i].h<<","<<ref[i].k
+                            <<","<<ref[i].l<<") where nxslib gives "<<ref[i].FSquare);
+        }
+      };
+      std::vector<nxs::NXS_HKL> v = ref;
+      calcFSquareDirect( cell.uc, v.data(), n );
+      check( v, "calcFSquareDirect", 1e-12 );
+      v = ref;
+      calcFSquareFFT( cell.uc, v.data(), n );
+      check( v, "calcFSquareFFT", 1e-8 );
+      v = ref;
+      calcFSquareFFT( cell.uc, v.data(), n, 1.5 );
+      check( v, "calcFSquareFFT (oversampling 1.5)", 1e-6 );
+    }
+
+    void testExplicitHKLValues( const NC::TextData& data, const NC::HKLList& hklList )
+    {
+      //Each family must come with the symmetry equivalent hkl points found by
+      //nxslib: one of each (h,k,l),(-h,-k,-l) pair, starting with the hkl of
+      //the family itself, and all with its d-spacing:
+      NCRYSTAL_MSG("Testing explicit hkl values of "<<data.dataSourceName());
+      NXSTestCell cell( data, 1 );
+      if ( hklList.empty() )
+        NCRYSTAL_THROW2(CalcError,"No hkl families loaded from "<<data.dataSourceName());
+      for ( auto& e : hklList ) {
+        if ( !e.explicitValues || 2 * e.explicitValues->list.size() != e.multiplicity )
+          NCRYSTAL_THROW2(CalcError,"Missing or incomplete explicit hkl values for hkl=("
+                          <<e.hkl.h<<","<<e.hkl.k<<","<<e.hkl.l<<")");
+        const auto& list = e.explicitValues->list;
+        if ( !sameHKL( list.front(), e.hkl ) )
+          NCRYSTAL_THROW2(CalcError,"Explicit hkl values for hkl=("<<e.hkl.h<<","<<e.hkl.k<<","<<e.hkl.l
+                          <<") do not start with that hkl");
+        for ( std::size_t i = 0; i < list.size(); ++i ) {
+          const NC::HKL& p = list[i];
+          const double d = nxs::nxs_calcDhkl( p.h, p.k, p.l, &cell.uc );
+          if ( !( std::fabs( d - e.dspacing ) <= 1e-9 * e.dspacing ) )
+            NCRYSTAL_THROW2(CalcError,"Explicit hkl value ("<<p.h<<","<<p.k<<","<<p.l<<") has d-spacing "<<d
+                            <<" but family has "<<e.dspacing);
+          for ( std::size_t j = 0; j < i; ++j ) {
+            const NC::HKL& q = list[j];
+            if ( sameHKL( p, q ) || sameHKL( p, NC::HKL{ -q.h, -q.k, -q.l } ) )
+              NCRYSTAL_THROW2(CalcError,"Duplicate explicit hkl value ("<<p.h<<","<<p.k<<","<<p.l<<")");
+          }
+        }
+      }
+    }
+
+    void testHKLCache( const NC::TextData& data )
+    {
+      //Publish the hkl list of a material in a new cache directory, and check
+      //that it is read back unchanged, but only with the same key and only
+      //from an intact file:
+#if defined(__unix__) || defined(__APPLE__)
+      NCRYSTAL_MSG("Testing hkl cache with "<<data.dataSourceName());
+      std::string cachedir = "/tmp/ncplugin_nxslib_test_XXXXXX";
+      if ( !::mkdtemp( &cachedir[0] ) )
+        NCRYSTAL_THROW(CalcError,"Could not create directory for hkl cache test");
+      struct Cleanup {
+        const std::string& dir;
+        ~Cleanup()
+        {
+          if ( DIR * d = ::opendir( dir.c_str() ) ) {
+            while ( const dirent * e = ::readdir( d ) ) {
+              if ( std::strcmp( e->d_name, "." ) != 0 && std::strcmp( e->d_name, ".." ) != 0 )
+                std::remove( ( dir + "/" + e->d_name ).c_str() );
+            }
+            ::closedir( d );
+          }
+          ::rmdir( dir.c_str() );
+        }
+      } cleanup{cachedir};
+
+      const unsigned maxhkl = 8;
+      NXSTestCell cell( data, maxhkl );
+      const NC::HKLList hklList = testHKLList( cell.uc );
+      HKLCacheKey key;
+      key.dataHash = hashTextData( data );
+      key.temperature = cell.uc.temperature;
+      key.maxhkl = maxhkl;
+      key.dspacingRange = { 0.1, NC::kInfinity };
+      key.fsquareCut = 1e-5;
+      if ( hklCacheLoad( cachedir, key ).has_value() )
+        NCRYSTAL_THROW(CalcError,"hkl cache hit in empty directory");
+      hklCacheStore( cachedir, key, hklList );
+      auto loaded = hklCacheLoad( cachedir, key );
+      if ( !loaded.has_value() || !sameHKLLists( loaded.value(), hklList ) )
+        NCRYSTAL_THROW(CalcError,"hkl list read from cache differs from the stored one");
+
+      HKLCacheKey otherKey = key;
+      otherKey.temperature = 77.0;
+      if ( hklCacheLoad( cachedir, otherKey ).has_value() )
+        NCRYSTAL_THROW(CalcError,"hkl cache hit for different temperature");
+      otherKey = key;
+      otherKey.fsquareOptions.engine = NXSFSquareOptions::Engine::FFT;
+      if ( hklCacheLoad( cachedir, otherKey ).has_value() )
+        NCRYSTAL_THROW(CalcError,"hkl cache hit for different |F|^2 engine");
+
+      //Truncate the (single) cache file:
+      unsigned nfiles = 0;
+      if ( DIR * d = ::opendir( cachedir.c_str() ) ) {
+        while ( const dirent * e = ::readdir( d ) ) {
+          const std::string fn = cachedir + "/" + e->d_name;
+          struct stat st;
+          if ( ::stat( fn.c_str(), &st ) == 0 && S_ISREG( st.st_mode ) ) {
+            ++nfiles;
+            nc_assert_always( ::truncate( fn.c_str(), st.st_size - 1 ) == 0 );
+          }
+        }
+        ::closedir( d );
+      }
+      if ( nfiles != 1 )
+        NCRYSTAL_THROW2(CalcError,"Expected one hkl cache file but found "<<nfiles);
+      if ( hklCacheLoad( cachedir, key ).has_value() )
+        NCRYSTAL_THROW(CalcError,"hkl cache hit for truncated file");
+#else
+      (void)data;
+#endif
+    }
+
+    void testBatchLoader()
+    {
+      //Load a few materials concurrently, including a duplicate and a failing
+      //request, and check that the results are those of NC::createInfo:
+      NCRYSTAL_MSG("Testing NXSBatchLoader");
+      const std::vector<std::string> cfgstrs = { "plugins::nxslib/Al_sg225.nxs",
+                                                 "plugins::nxslib/Fe_sg229_Iron-alpha.nxs;temp=77K",
+                                                 "plugins::nxslib/Al_sg225.nxs",
+                                                 "plugins::nxslib/nonexistent_file.nxs" };
+      const std::size_t idx_bad = 3;
+      std::mutex mtx;
+      std::vector<unsigned> ncallbacks( cfgstrs.size(), 0 );
+      std::vector<bool> callbackerror( cfgstrs.size(), false );
+      NXSBatchLoader loader( cfgstrs, 2,
+                             [&mtx,&ncallbacks,&callbackerror]( std::size_t idx, NC::InfoPtr info, std::exception_ptr error )
+                             {
+                               NCRYSTAL_LOCK_GUARD(mtx);
+                               ++ncallbacks.at(idx);
+                               callbackerror.at(idx) = ( error && !info );
+                             } );
+      loader.wait();
+      for ( std::size_t idx = 0; idx < cfgstrs.size(); ++idx ) {
+        NC::InfoPtr info;
+        bool failed = false;
+        try {
+          info = loader.future(idx).get();
+        } catch ( NC::Error& ) {
+          failed = true;
+        }
+        if ( ncallbacks.at(idx) != 1 )
+          NCRYSTAL_THROW2(CalcError,"NXSBatchLoader invoked callback "<<ncallbacks.at(idx)
+                          <<" times for request "<<idx);
+        if ( failed != ( idx == idx_bad ) || callbackerror.at(idx) != failed )
+          NCRYSTAL_THROW2(CalcError,"Unexpected outcome of NXSBatchLoader request "<<idx);
+        if ( !failed && info != NC::createInfo( cfgstrs.at(idx) ) )
+          NCRYSTAL_THROW2(CalcError,"NXSBatchLoader result of request "<<idx
+                          <<" is not the object cached by NC::createInfo");
+      }
+
+      //Requests cancelled before they are started fail without invoking the
+      //callback:
+      std::atomic<unsigned> ncompleted{0};
+      NXSBatchLoader loader2( std::vector<std::string>( 20, "plugins::nxslib/Al_sg225.nxs;temp=250K" ), 1,
+                              [&ncompleted]( std::size_t, NC::InfoPtr, std::exception_ptr ) { ++ncompleted; } );
+      loader2.cancel();
+      loader2.wait();
+      unsigned nloaded = 0;
+      for ( std::size_t idx = 0; idx < loader2.size(); ++idx ) {
+        try {
+          if ( loader2.future(idx).get() )
+            ++nloaded;
+        } catch ( NC::Error& ) {
+        }
+      }
+      if ( nloaded != ncompleted )
+        NCRYSTAL_THROW2(CalcError,"NXSBatchLoader completed "<<nloaded<<" requests after cancel, but invoked callback "
+                        <<ncompleted<<" times");
+    }
+
+
+    void testSingleFlightLoads()
+    {
+      //Requests for the same key from several threads at once must all get
+      //the result (or exception) of a single producer call, while later
+      //requests start a new load:
+      NCRYSTAL_MSG("Testing SingleFlightLoads");
+      SingleFlightLoads sfl;
+      const SingleFlightLoads::Key key{ 17, 293.15, 0.0, 0.0 };
+      const unsigned nthreads = 8;
+      for ( bool fail : { false, true } ) {
+        std::atomic<unsigned> narrived{0}, ncalls{0}, nfailed{0};
+        std::vector<NC::InfoPtr> results( nthreads );
+        auto produce = [fail,nthreads,&narrived,&ncalls]()
+        {
+          ++ncalls;
+          //Give the other threads time to find the load in flight:
+          while ( narrived < nthreads )
+            std::this_thread::yield();
+          std::this_thread::sleep_for( std::chrono::milliseconds(100) );
+          if ( fail )
+            NCRYSTAL_THROW(DataLoadError,"Failure of test load");
+          return NC::createInfo( "plugins::nxslib/Al_sg225.nxs" );
+        };
+        std::vector<std::thread> threads;
+        for ( unsigned i = 0; i < nthreads; ++i ) {
+          threads.emplace_back( [&sfl,&key,&produce,&narrived,&nfailed,&results,i]()
+          {
+            ++narrived;
+            try {
+              results.at(i) = sfl.getOrProduce( key, produce );
+            } catch ( NC::Error& ) {
+              ++nfailed;
+            }
+          } );
+        }
+        for ( auto& t : threads )
+          t.join();
+        if ( ncalls != 1 )
+          NCRYSTAL_THROW2(CalcError,"SingleFlightLoads invoked producer "<<ncalls<<" times for concurrent requests");
+        if ( nfailed != ( fail ? nthreads : 0 ) )
+          NCRYSTAL_THROW2(CalcError,"SingleFlightLoads failed "<<nfailed<<" of "<<nthreads<<" requests");
+        for ( auto& r : results )
+          if ( r != results.front() || ( !fail && !r ) )
+            NCRYSTAL_THROW(CalcError,"SingleFlightLoads returned different results for concurrent requests");
+        narrived = nthreads;
+        try {
+          sfl.getOrProduce( key, produce );
+        } catch ( NC::Error& ) {
+        }
+        if ( ncalls != 2 )
+          NCRYSTAL_THROW(CalcError,"SingleFlightLoads did not start a new load after the previous one finished");
+      }
+
+      //The same via NC::createInfo, for data not loaded before:
+      const std::string cfgstr = "plugins::nxslib/Sn_sg141.nxs;temp=345.6K";
+      std::vector<NC::InfoPtr> infos( nthreads );
+      std::vector<std::thread> threads;
+      for ( unsigned i = 0; i < nthreads; ++i )
+        threads.emplace_back( [&infos,&cfgstr,i]()
+        {
+          try {
+            infos.at(i) = NC::createInfo( cfgstr );
+          } catch ( NC::Error& ) {
+          }
+        } );
+      for ( auto& t : threads )
+        t.join();
+      for ( auto& info : infos )
+        if ( !info || info != infos.front() )
+          NCRYSTAL_THROW(CalcError,"Concurrent NC::createInfo calls for the same material gave different results");
+    }
+
+  }
+}
 
 void NCP::customPluginTest()
 {
@@ -34,6 +1083,43 @@ void NCP::customPluginTest()
 
   NCRYSTAL_MSG("Testing plugin "<<pluginName());
 
+  testTriclinicDSpacings();
+  testHKLCache( *bundledNXSData( "Sn_sg141.nxs" ) );
+  testBatchLoader();
+  testSingleFlightLoads();
+
+  const std::vector<std::string> bundledFiles = bundledNXSFiles();
+  NCRYSTAL_MSG("Testing parseNXSData with "<<bundledFiles.size()<<" bundled files");
+  for ( auto& fn : bundledFiles )
+    testParseNXSData( *bundledNXSData( fn ) );
+
+  //(333) and (511) of fcc Al have the same d-spacing:
+  testMergeEqualDSpacings( *bundledNXSData( "Al_sg225.nxs" ), true );
+  testMergeEqualDSpacings( *bundledNXSData( "Sn_sg141.nxs" ), true );
+  testPruneHKLList( *bundledNXSData( "Bi_sg166.nxs" ), 1e-3 );
+  testPruneHKLList( *bundledNXSData( "Sn_sg141.nxs" ), 1e-2 );
+  testCompactHKL( *bundledNXSData( "Bi_sg166.nxs" ) );
+  testCompactHKL( *bundledNXSData( "Fe_sg229_Iron-alpha.nxs" ) );
+  testFSquareFFT();
+  for ( std::string fn : { "Al_sg225.nxs", "Bi_sg166.nxs", "Fe_sg229_Iron-alpha.nxs", "Zr_sg194.nxs" } )
+    testCoherentElasticCumSums( *bundledNXSData( fn ) );
+  testCoherentElasticSpectrum( *bundledNXSData( "Bi_sg166.nxs" ) );
+  testCoherentElasticSpectrum( *bundledNXSData( "Sn_sg141.nxs" ) );
+  testTextureModel();
+  testTexturedScatter();
+  for ( std::string fn : { "Al_sg225.nxs", "Bi_sg166.nxs", "C_sg227_Diamond.nxs", "Sn_sg141.nxs" } )
+    testBkgdKernel( *bundledNXSData( fn ) );
+  for ( std::string fn : { "Al_sg225.nxs", "Bi_sg166.nxs", "Fe_sg229_Iron-alpha.nxs", "Zr_sg194.nxs" } )
+    testBkgdTable( *bundledNXSData( fn ) );
+  testSharedBkgdTable();
+  for ( std::string fn : { "Al_sg225.nxs", "Fe_sg229_Iron-alpha.nxs", "Zr_sg194.nxs" } )
+    testBkgdScatter( fn );
+
+  for ( std::string fn : { "Al_sg225.nxs", "Sn_sg141.nxs", "Zr_sg194.nxs", "Bi_sg166.nxs" } ) {
+    auto info_fn = NC::createInfo( "plugins::nxslib/" + fn );
+    testExplicitHKLValues( *bundledNXSData( fn ), info_fn->hklList() );
+  }
+
   // File Al.nxs
   const char * testdata =
     "space_group = 225\n"